@@ -1,4 +1,7 @@
 #include "plink_binary.h"
+#include "snp_prefetcher.h"
+#include "genotype_formatter.h"
+#include <cstdio>
 #include <fstream>
 #include <vector>
 
@@ -28,17 +31,28 @@ int main(int argc, char *argv[])
     ofstream tped(fn.c_str());
 
     gftools::snp snp;
-    vector<string> gt;
-
-    while (pb->next_snp(snp, gt)) {
-        tped << snp.chromosome << " ";
-        tped << snp.name << " ";
-        tped << snp.genetic_position << " ";
-        tped << snp.physical_position;
-        for (unsigned int i = 0; i < gt.size(); i++) {
-            tped << " " << gt[i][0] << " " << gt[i][1];
+    vector<uint8_t> gt;
+    gftools::genotype_formatter formatter(" ", " ", pb->missing_genotype);
+    vector<char> line;
+    char positions[32];
+
+    // Read and decode ahead while formatting; the reader stops before the
+    // dataset is closed
+    {
+        gftools::snp_prefetcher reader(*pb);
+        while (reader.next_snp(snp, gt)) {
+            line.assign(snp.chromosome.begin(), snp.chromosome.end());
+            line.push_back(' ');
+            line.insert(line.end(), snp.name.begin(), snp.name.end());
+            int n = snprintf(positions, sizeof(positions), " %d %d",
+                             snp.genetic_position, snp.physical_position);
+            line.insert(line.end(), positions, positions + n);
+
+            formatter.set_snp(snp);
+            formatter.append(gt, line);
+            line.push_back('\n');
+            tped.write(&line[0], line.size());
         }
-        tped << endl;
     }
 
     tped.close();
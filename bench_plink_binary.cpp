@@ -0,0 +1,179 @@
+/*
+ * Benchmark the per-SNP read and write paths of plink_binary, counting the
+ * heap allocations made per SNP once the first SNP has warmed up buffers.
+ * Exits nonzero if any path allocates after warming up.
+ *
+ * Usage: bench_plink_binary [ SAMPLES [ SNPS ] ]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+#include <unistd.h>
+#include "plink_binary.h"
+
+using namespace std;
+
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+struct timer {
+    struct timeval start;
+    size_t start_allocations;
+    bool allocated;
+
+    timer() : allocated(false) {}
+
+    void reset() {
+        gettimeofday(&start, NULL);
+        start_allocations = allocations;
+    }
+
+    void report(const char *name, int snps) {
+        struct timeval end;
+        gettimeofday(&end, NULL);
+        double elapsed = (end.tv_sec - start.tv_sec) +
+            (end.tv_usec - start.tv_usec) / 1e6;
+        size_t n = allocations - start_allocations;
+        printf("%-24s %8d SNPs %9.3f s %12.0f SNPs/s %8.3f allocations/SNP\n",
+               name, snps, elapsed, snps / elapsed, (double) n / snps);
+        if (n > 0) {
+            fprintf(stderr, "Error: %s allocated after warming up\n", name);
+            allocated = true;
+        }
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    int n_samples = argc > 1 ? atoi(argv[1]) : 20000;
+    int n_snps = argc > 2 ? atoi(argv[2]) : 2000;
+    if (n_samples < 1 || n_snps < 2) {
+        printf("Usage: %s [ SAMPLES [ SNPS ] ]\n", argv[0]);
+        return 1;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "/tmp/bench_plink_binary_%d", (int) getpid());
+    string dataset(name);
+
+    vector<int> genotypes(n_samples);
+    unsigned int x = 1;
+    for (int i = 0; i < n_samples; i++) {
+        x = x * 1103515245 + 12345;
+        genotypes[i] = (x >> 16) % 4;
+    }
+
+    timer t;
+    gftools::snp snp;
+    snp.allele_a = "A";
+    snp.allele_b = "G";
+
+    // Write
+    plink_binary *pb = new plink_binary();
+    for (int i = 0; i < n_samples; i++) {
+        snprintf(name, sizeof(name), "sample_%d", i);
+        pb->individuals.push_back(gftools::individual(name, name, "-9", "-9",
+                                                      "-9", "-9"));
+    }
+    pb->open(dataset, true);
+    pb->snps.reserve(n_snps);
+    for (int i = 0; i < n_snps; i++) {
+        if (i == 1) {
+            t.reset();
+        }
+        snprintf(name, sizeof(name), "rs%d", i);
+        snp.name.assign(name);
+        pb->write_snp(snp, genotypes);
+    }
+    t.report("write_snp(int)", n_snps - 1);
+    vector<gftools::individual> individuals = pb->individuals;
+    pb->close();
+    delete pb;
+
+    pb = new plink_binary();
+    pb->individuals = individuals;
+    pb->open(dataset, true);
+    pb->presize_snps(n_snps);
+    vector<uint8_t> codes(genotypes.begin(), genotypes.end());
+    for (int i = 0; i < n_snps; i++) {
+        if (i == 1) {
+            t.reset();
+        }
+        snprintf(name, sizeof(name), "rs%d", i);
+        snp.name.assign(name);
+        pb->write_snp_at(i, snp, codes);
+    }
+    t.report("write_snp_at(uint8_t)", n_snps - 1);
+    pb->close();
+    delete pb;
+
+    pb = new plink_binary(dataset);
+    for (int i = 0; i < n_snps; i++) {
+        if (i == 1) {
+            t.reset();
+        }
+        pb->read_snp(i, genotypes);
+    }
+    t.report("read_snp(int)", n_snps - 1);
+
+    size_t counts[4], total = 0;
+    for (int i = 0; i < n_snps; i++) {
+        if (i == 1) {
+            t.reset();
+        }
+        pb->view_snp(i).count_calls(counts);
+        total += counts[0];
+    }
+    t.report("view_snp/count_calls", n_snps - 1);
+    pb->close();
+    delete pb;
+
+    pb = new plink_binary(dataset);
+    for (int i = 0; pb->next_snp(snp, genotypes); i++) {
+        if (i == 0) {
+            t.reset();
+        }
+    }
+    t.report("next_snp(int)", n_snps - 1);
+    pb->close();
+    delete pb;
+
+    pb = new plink_binary(dataset);
+    vector<string> calls;
+    for (int i = 0; pb->next_snp(snp, calls); i++) {
+        if (i == 0) {
+            t.reset();
+        }
+    }
+    t.report("next_snp(string)", n_snps - 1);
+    pb->close();
+    delete pb;
+
+    const char *suffixes[] = { ".bed", ".bim", ".fam" };
+    for (int i = 0; i < 3; i++) {
+        remove((dataset + suffixes[i]).c_str());
+    }
+
+    // Using the counts keeps count_calls from being optimised away
+    return t.allocated || total > (size_t) n_samples * n_snps;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cctype>
+#include <sstream>
+
+#include "chromosome.h"
+
+using std::string;
+
+namespace gftools {
+
+    int chromosome_code(const string &name) {
+        string s;
+        for (size_t i = 0; i < name.size(); i++) {
+            s += toupper((unsigned char) name[i]);
+        }
+        if (s.compare(0, 3, "CHR") == 0) {
+            s.erase(0, 3);
+        }
+
+        if (s == "X") {
+            return CHROMOSOME_X;
+        }
+        if (s == "Y") {
+            return CHROMOSOME_Y;
+        }
+        if (s == "XY") {
+            return CHROMOSOME_XY;
+        }
+        if (s == "MT" || s == "M") {
+            return CHROMOSOME_MT;
+        }
+
+        if (s.empty() || s.size() > 3) {
+            return 0;
+        }
+        int code = 0;
+        for (size_t i = 0; i < s.size(); i++) {
+            if (!isdigit((unsigned char) s[i])) {
+                return 0;
+            }
+            code = 10 * code + (s[i] - '0');
+        }
+        return code <= MAX_CHROMOSOME ? code : 0;
+    }
+
+    string chromosome_name(int code) {
+        switch (code) {
+            case CHROMOSOME_X:
+                return "X";
+            case CHROMOSOME_Y:
+                return "Y";
+            case CHROMOSOME_XY:
+                return "XY";
+            case CHROMOSOME_MT:
+                return "MT";
+        }
+        if (code < 1 || code > MAX_CHROMOSOME) {
+            return "0";
+        }
+        std::stringstream ss;
+        ss << code;
+        return ss.str();
+    }
+
+    unsigned int chromosome_class(int code) {
+        switch (code) {
+            case CHROMOSOME_X:
+                return X_LINKED;
+            case CHROMOSOME_Y:
+                return Y_LINKED;
+            case CHROMOSOME_XY:
+                return PSEUDOAUTOSOMAL;
+            case CHROMOSOME_MT:
+                return MITOCHONDRIAL;
+        }
+        return code >= 1 && code < CHROMOSOME_X ? AUTOSOMAL : UNPLACED;
+    }
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GFTOOLS_CHROMOSOME_H
+#define GFTOOLS_CHROMOSOME_H
+
+#include <string>
+
+namespace gftools {
+    /// The Plink codes of the sex and mitochondrial chromosomes, which
+    /// follow the autosomes 1 to 22. Code 0 is an unplaced SNP.
+    const int CHROMOSOME_X = 23;
+    const int CHROMOSOME_Y = 24;
+    const int CHROMOSOME_XY = 25;
+    const int CHROMOSOME_MT = 26;
+    /// The largest chromosome code.
+    const int MAX_CHROMOSOME = 26;
+
+    /// Class flags of a SNP, given by its chromosome.
+    const unsigned int AUTOSOMAL = 1;
+    const unsigned int X_LINKED = 2;
+    const unsigned int Y_LINKED = 4;
+    const unsigned int PSEUDOAUTOSOMAL = 8;
+    const unsigned int MITOCHONDRIAL = 16;
+    const unsigned int UNPLACED = 32;
+
+    /** Returns the code of a chromosome name.
+     *
+     * Recognises 1 to 26 and X, Y, XY and MT, as used by Plink, ignoring
+     * case and any "chr" prefix, and the alias M for MT.
+     *
+     * @param name A chromosome name.
+     * @return The code, or 0 if the name is not recognised.
+     */
+    int chromosome_code(const std::string &name);
+
+    /** Returns the Plink name of a chromosome code, i.e. 1 to 22, X, Y,
+     * XY or MT, or 0 for an unknown code.
+     */
+    std::string chromosome_name(int code);
+
+    /** Returns the class flags of SNPs on a chromosome.
+     *
+     * @param code A chromosome code.
+     * @return One of AUTOSOMAL, X_LINKED, Y_LINKED, PSEUDOAUTOSOMAL,
+     * MITOCHONDRIAL or UNPLACED.
+     */
+    unsigned int chromosome_class(int code);
+}
+
+#endif // GFTOOLS_CHROMOSOME_H
@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include "genotype_codec.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GFTOOLS_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Plink encodes in two bits as: 1 (no call); 0 (AA); 2 (AB); 3 (BB)
+// (after reversal of the bit pairs, see plink_binary.cpp). These are the
+// corresponding genotype call codes, indexed by the Plink encoding.
+static const uint8_t call_codes[4] = { 1, 0, 2, 3 };
+
+// Conveniently, the mapping is its own inverse: these are also the Plink
+// encodings, indexed by genotype call code.
+static const uint8_t plink_codes[4] = { 1, 0, 2, 3 };
+
+static inline unsigned char plink_code(uint8_t call) {
+    return call > 3 ? 1 : plink_codes[call];
+}
+
+// Decoded calls for every possible packed byte
+struct unpack_table {
+    uint8_t codes[256][4];
+    int32_t int_codes[256][4];
+
+    unpack_table() {
+        for (int i = 0; i < 256; i++) {
+            for (int j = 0; j < 4; j++) {
+                codes[i][j] = call_codes[(i >> (2 * j)) & 3];
+                int_codes[i][j] = codes[i][j];
+            }
+        }
+    }
+};
+
+static const unpack_table table;
+
+typedef void (*unpacker)(const unsigned char *, size_t, uint8_t *);
+
+typedef void (*packer)(const uint8_t *, size_t, unsigned char *);
+
+static packer select_packer() {
+    if (gftools::has_avx2()) {
+        return gftools::pack_calls_avx2;
+    }
+    if (gftools::has_ssse3()) {
+        return gftools::pack_calls_ssse3;
+    }
+    return gftools::pack_calls_scalar;
+}
+
+static unpacker select_unpacker() {
+    if (gftools::has_avx2()) {
+        return gftools::unpack_calls_avx2;
+    }
+    if (gftools::has_ssse3()) {
+        return gftools::unpack_calls_ssse3;
+    }
+    return gftools::unpack_calls_table;
+}
+
+namespace gftools {
+
+    void unpack_calls(const unsigned char *packed, size_t n, uint8_t *calls) {
+        static const unpacker unpack = select_unpacker();
+        unpack(packed, n, calls);
+    }
+
+    void unpack_calls(const unsigned char *packed, size_t n, int *calls) {
+        static const unpacker unpack = select_unpacker();
+
+        if (unpack == unpack_calls_table) {
+            size_t full = n / 4;
+            for (size_t i = 0; i < full; i++) {
+                memcpy(calls + 4 * i, table.int_codes[packed[i]],
+                       4 * sizeof(int));
+            }
+            for (size_t i = full * 4; i < n; i++) {
+                calls[i] = call_codes[(packed[i / 4] >> (2 * (i % 4))) & 3];
+            }
+            return;
+        }
+
+        // Decode in chunks that stay in L1 cache, then widen
+        const size_t chunk_len = 1024;
+        uint8_t chunk[chunk_len];
+        for (size_t i = 0; i < n; i += chunk_len) {
+            size_t len = n - i < chunk_len ? n - i : chunk_len;
+            unpack(packed + i / 4, len, chunk);
+            for (size_t j = 0; j < len; j++) {
+                calls[i + j] = chunk[j];
+            }
+        }
+    }
+
+    void unpack_calls_scalar(const unsigned char *packed, size_t n,
+                             uint8_t *calls) {
+        unsigned char c = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (!(i % 4)) {
+                c = packed[i / 4];
+            }
+            calls[i] = call_codes[c & 3];
+            c >>= 2;
+        }
+    }
+
+    void unpack_calls_table(const unsigned char *packed, size_t n,
+                            uint8_t *calls) {
+        size_t full = n / 4;
+        for (size_t i = 0; i < full; i++) {
+            memcpy(calls + 4 * i, table.codes[packed[i]], 4);
+        }
+        if (n % 4) {
+            memcpy(calls + 4 * full, table.codes[packed[full]], n % 4);
+        }
+    }
+
+    void pack_calls(const uint8_t *calls, size_t n, unsigned char *packed) {
+        static const packer pack = select_packer();
+        pack(calls, n, packed);
+    }
+
+    void pack_calls(const int *calls, size_t n, unsigned char *packed) {
+        static const packer pack = select_packer();
+
+        // Narrow in chunks that stay in L1 cache; anything out of range,
+        // including negative codes, becomes a no call
+        const size_t chunk_len = 1024;
+        uint8_t chunk[chunk_len];
+        for (size_t i = 0; i < n; i += chunk_len) {
+            size_t len = n - i < chunk_len ? n - i : chunk_len;
+            for (size_t j = 0; j < len; j++) {
+                unsigned int call = calls[i + j];
+                chunk[j] = call > 3 ? 0 : call;
+            }
+            pack(chunk, len, packed + i / 4);
+        }
+    }
+
+    void pack_calls_scalar(const uint8_t *calls, size_t n,
+                           unsigned char *packed) {
+        size_t full = n / 4;
+        for (size_t i = 0; i < full; i++) {
+            const uint8_t *c = calls + 4 * i;
+            packed[i] = plink_code(c[0])
+                | (plink_code(c[1]) << 2)
+                | (plink_code(c[2]) << 4)
+                | (plink_code(c[3]) << 6);
+        }
+        if (n % 4) {
+            unsigned char c = 0;
+            for (size_t i = 0; i < n % 4; i++) {
+                c |= plink_code(calls[4 * full + i]) << (2 * i);
+            }
+            packed[full] = c;
+        }
+    }
+
+#ifdef GFTOOLS_X86_SIMD
+    // Calls are translated to Plink encodings by a byte shuffle (after
+    // clamping out of range codes to an index that translates to no call),
+    // then each run of four is combined into one byte by multiply-adds.
+
+    __attribute__((target("ssse3")))
+    void pack_calls_ssse3(const uint8_t *calls, size_t n,
+                          unsigned char *packed) {
+        const __m128i codes = _mm_setr_epi8(1, 0, 2, 3, 1, 1, 1, 1,
+                                            1, 1, 1, 1, 1, 1, 1, 1);
+        const __m128i limit = _mm_set1_epi8(4);
+        const __m128i shift2 = _mm_set1_epi16(0x0401);
+        const __m128i shift4 = _mm_set1_epi32(0x00100001);
+        size_t blocks = n / 64;
+
+        for (size_t i = 0; i < blocks; i++) {
+            __m128i words[4];
+            for (int j = 0; j < 4; j++) {
+                __m128i x = _mm_loadu_si128((const __m128i *)
+                                            (calls + 64 * i + 16 * j));
+                x = _mm_shuffle_epi8(codes, _mm_min_epu8(x, limit));
+                x = _mm_maddubs_epi16(x, shift2);
+                words[j] = _mm_madd_epi16(x, shift4);
+            }
+            __m128i lo = _mm_packs_epi32(words[0], words[1]);
+            __m128i hi = _mm_packs_epi32(words[2], words[3]);
+            _mm_storeu_si128((__m128i *) (packed + 16 * i),
+                             _mm_packus_epi16(lo, hi));
+        }
+
+        pack_calls_scalar(calls + 64 * blocks, n - 64 * blocks,
+                          packed + 16 * blocks);
+    }
+
+    __attribute__((target("avx2")))
+    void pack_calls_avx2(const uint8_t *calls, size_t n,
+                         unsigned char *packed) {
+        const __m256i codes = _mm256_setr_epi8(1, 0, 2, 3, 1, 1, 1, 1,
+                                               1, 1, 1, 1, 1, 1, 1, 1,
+                                               1, 0, 2, 3, 1, 1, 1, 1,
+                                               1, 1, 1, 1, 1, 1, 1, 1);
+        const __m256i limit = _mm256_set1_epi8(4);
+        const __m256i shift2 = _mm256_set1_epi16(0x0401);
+        const __m256i shift4 = _mm256_set1_epi32(0x00100001);
+        // The packs work within 128-bit lanes; this restores call order
+        const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+        size_t blocks = n / 128;
+
+        for (size_t i = 0; i < blocks; i++) {
+            __m256i words[4];
+            for (int j = 0; j < 4; j++) {
+                __m256i x = _mm256_loadu_si256((const __m256i *)
+                                               (calls + 128 * i + 32 * j));
+                x = _mm256_shuffle_epi8(codes, _mm256_min_epu8(x, limit));
+                x = _mm256_maddubs_epi16(x, shift2);
+                words[j] = _mm256_madd_epi16(x, shift4);
+            }
+            __m256i lo = _mm256_packs_epi32(words[0], words[1]);
+            __m256i hi = _mm256_packs_epi32(words[2], words[3]);
+            __m256i bytes = _mm256_packus_epi16(lo, hi);
+            _mm256_storeu_si256((__m256i *) (packed + 32 * i),
+                                _mm256_permutevar8x32_epi32(bytes, order));
+        }
+
+        pack_calls_ssse3(calls + 128 * blocks, n - 128 * blocks,
+                         packed + 32 * blocks);
+    }
+
+    // Each block of packed bytes is split into four vectors holding the
+    // 1st, 2nd, 3rd and 4th call of each byte, these are translated to call
+    // codes by a byte shuffle and then interleaved back into call order.
+
+    __attribute__((target("ssse3")))
+    void unpack_calls_ssse3(const unsigned char *packed, size_t n,
+                            uint8_t *calls) {
+        const __m128i codes = _mm_setr_epi8(1, 0, 2, 3, 0, 0, 0, 0,
+                                            0, 0, 0, 0, 0, 0, 0, 0);
+        const __m128i mask = _mm_set1_epi8(3);
+        size_t blocks = n / 64;
+
+        for (size_t i = 0; i < blocks; i++) {
+            __m128i x = _mm_loadu_si128((const __m128i *) (packed + 16 * i));
+            __m128i c0 = _mm_shuffle_epi8(codes, _mm_and_si128(x, mask));
+            __m128i c1 = _mm_shuffle_epi8(codes,
+                _mm_and_si128(_mm_srli_epi16(x, 2), mask));
+            __m128i c2 = _mm_shuffle_epi8(codes,
+                _mm_and_si128(_mm_srli_epi16(x, 4), mask));
+            __m128i c3 = _mm_shuffle_epi8(codes,
+                _mm_and_si128(_mm_srli_epi16(x, 6), mask));
+
+            __m128i lo01 = _mm_unpacklo_epi8(c0, c1);
+            __m128i hi01 = _mm_unpackhi_epi8(c0, c1);
+            __m128i lo23 = _mm_unpacklo_epi8(c2, c3);
+            __m128i hi23 = _mm_unpackhi_epi8(c2, c3);
+
+            __m128i *out = (__m128i *) (calls + 64 * i);
+            _mm_storeu_si128(out,     _mm_unpacklo_epi16(lo01, lo23));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(lo01, lo23));
+            _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(hi01, hi23));
+            _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(hi01, hi23));
+        }
+
+        unpack_calls_table(packed + 16 * blocks, n - 64 * blocks,
+                           calls + 64 * blocks);
+    }
+
+    __attribute__((target("avx2")))
+    void unpack_calls_avx2(const unsigned char *packed, size_t n,
+                           uint8_t *calls) {
+        const __m256i codes = _mm256_setr_epi8(1, 0, 2, 3, 0, 0, 0, 0,
+                                               0, 0, 0, 0, 0, 0, 0, 0,
+                                               1, 0, 2, 3, 0, 0, 0, 0,
+                                               0, 0, 0, 0, 0, 0, 0, 0);
+        const __m256i mask = _mm256_set1_epi8(3);
+        size_t blocks = n / 128;
+
+        for (size_t i = 0; i < blocks; i++) {
+            __m256i x = _mm256_loadu_si256((const __m256i *) (packed + 32 * i));
+            __m256i c0 = _mm256_shuffle_epi8(codes, _mm256_and_si256(x, mask));
+            __m256i c1 = _mm256_shuffle_epi8(codes,
+                _mm256_and_si256(_mm256_srli_epi16(x, 2), mask));
+            __m256i c2 = _mm256_shuffle_epi8(codes,
+                _mm256_and_si256(_mm256_srli_epi16(x, 4), mask));
+            __m256i c3 = _mm256_shuffle_epi8(codes,
+                _mm256_and_si256(_mm256_srli_epi16(x, 6), mask));
+
+            __m256i lo01 = _mm256_unpacklo_epi8(c0, c1);
+            __m256i hi01 = _mm256_unpackhi_epi8(c0, c1);
+            __m256i lo23 = _mm256_unpacklo_epi8(c2, c3);
+            __m256i hi23 = _mm256_unpackhi_epi8(c2, c3);
+
+            // The unpacks work within 128-bit lanes; the low lanes hold
+            // packed bytes 0-15 and the high lanes packed bytes 16-31
+            __m256i r0 = _mm256_unpacklo_epi16(lo01, lo23);
+            __m256i r1 = _mm256_unpackhi_epi16(lo01, lo23);
+            __m256i r2 = _mm256_unpacklo_epi16(hi01, hi23);
+            __m256i r3 = _mm256_unpackhi_epi16(hi01, hi23);
+
+            __m256i *out = (__m256i *) (calls + 128 * i);
+            _mm256_storeu_si256(out,     _mm256_permute2x128_si256(r0, r1, 0x20));
+            _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(r2, r3, 0x20));
+            _mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(r0, r1, 0x31));
+            _mm256_storeu_si256(out + 3, _mm256_permute2x128_si256(r2, r3, 0x31));
+        }
+
+        unpack_calls_ssse3(packed + 32 * blocks, n - 128 * blocks,
+                           calls + 128 * blocks);
+    }
+
+    bool has_ssse3() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("ssse3");
+    }
+
+    bool has_avx2() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+
+    bool has_bmi2() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("bmi2");
+    }
+#else
+    void pack_calls_ssse3(const uint8_t *calls, size_t n,
+                          unsigned char *packed) {
+        pack_calls_scalar(calls, n, packed);
+    }
+
+    void pack_calls_avx2(const uint8_t *calls, size_t n,
+                         unsigned char *packed) {
+        pack_calls_scalar(calls, n, packed);
+    }
+
+    void unpack_calls_ssse3(const unsigned char *packed, size_t n,
+                            uint8_t *calls) {
+        unpack_calls_table(packed, n, calls);
+    }
+
+    void unpack_calls_avx2(const unsigned char *packed, size_t n,
+                           uint8_t *calls) {
+        unpack_calls_table(packed, n, calls);
+    }
+
+    bool has_ssse3() {
+        return false;
+    }
+
+    bool has_avx2() {
+        return false;
+    }
+
+    bool has_bmi2() {
+        return false;
+    }
+#endif
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GFTOOLS_GENOTYPE_CODEC_H
+#define GFTOOLS_GENOTYPE_CODEC_H
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace gftools {
+
+    /** Decodes packed BED genotype calls into genotype call codes.
+     *
+     * The codes are those used by plink_binary: 0 (no call), 1 (AA), 2 (AB)
+     * and 3 (BB). The fastest decoder supported by the CPU is chosen at
+     * run time.
+     *
+     * @param packed The packed calls, four per byte.
+     * @param n The number of calls to decode.
+     * @param calls An array of at least n codes, overwritten.
+     */
+    void unpack_calls(const unsigned char *packed, size_t n, uint8_t *calls);
+
+    /** Decodes packed BED genotype calls into integer genotype call codes.
+     *
+     * @see unpack_calls(const unsigned char *packed, size_t n, uint8_t *calls)
+     */
+    void unpack_calls(const unsigned char *packed, size_t n, int *calls);
+
+    /** Decodes packed calls one at a time. This is the reference decoder.
+     */
+    void unpack_calls_scalar(const unsigned char *packed, size_t n,
+                             uint8_t *calls);
+
+    /** Decodes packed calls a byte at a time, using a lookup table.
+     */
+    void unpack_calls_table(const unsigned char *packed, size_t n,
+                            uint8_t *calls);
+
+    /** Decodes packed calls 16 bytes at a time, using SSSE3 byte shuffles.
+     * Only call this if has_ssse3() is true.
+     */
+    void unpack_calls_ssse3(const unsigned char *packed, size_t n,
+                            uint8_t *calls);
+
+    /** Decodes packed calls 32 bytes at a time, using AVX2 byte shuffles.
+     * Only call this if has_avx2() is true.
+     */
+    void unpack_calls_avx2(const unsigned char *packed, size_t n,
+                           uint8_t *calls);
+
+    /** Encodes genotype call codes as packed BED genotype calls.
+     *
+     * Codes other than 1 (AA), 2 (AB) and 3 (BB) are encoded as no call.
+     * Any unused bits of the last byte are zeroed. The fastest encoder
+     * supported by the CPU is chosen at run time.
+     *
+     * @param calls An array of n genotype call codes.
+     * @param n The number of calls to encode.
+     * @param packed An array of at least (n + 3) / 4 bytes, overwritten.
+     */
+    void pack_calls(const uint8_t *calls, size_t n, unsigned char *packed);
+
+    /** Encodes integer genotype call codes as packed BED genotype calls.
+     *
+     * @see pack_calls(const uint8_t *calls, size_t n, unsigned char *packed)
+     */
+    void pack_calls(const int *calls, size_t n, unsigned char *packed);
+
+    /** Encodes calls a byte at a time. This is the reference encoder.
+     */
+    void pack_calls_scalar(const uint8_t *calls, size_t n,
+                           unsigned char *packed);
+
+    /** Encodes calls 64 at a time, using SSSE3.
+     * Only call this if has_ssse3() is true.
+     */
+    void pack_calls_ssse3(const uint8_t *calls, size_t n,
+                          unsigned char *packed);
+
+    /** Encodes calls 128 at a time, using AVX2.
+     * Only call this if has_avx2() is true.
+     */
+    void pack_calls_avx2(const uint8_t *calls, size_t n,
+                         unsigned char *packed);
+
+    /** Returns true if the CPU supports the SSSE3 codecs.
+     */
+    bool has_ssse3();
+
+    /** Returns true if the CPU supports the AVX2 codecs.
+     */
+    bool has_avx2();
+
+    /** Returns true if the CPU supports BMI2 bit extraction, used to
+     * gather the calls of a sample_subset.
+     */
+    bool has_bmi2();
+}
+
+#endif // GFTOOLS_GENOTYPE_CODEC_H
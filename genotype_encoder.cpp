@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "exceptions.h"
+#include "genotype_encoder.h"
+
+using std::string;
+
+namespace gftools {
+
+    genotype_encoder::genotype_encoder(char missing_genotype)
+        : missing_genotype(missing_genotype) {
+        set_snp(snp());
+    }
+
+    void genotype_encoder::set_snp(const snp &snp) {
+        current = snp;
+        memset(slots, UNSEEN, sizeof(slots));
+        allele_count = 0;
+        collating = snp.allele_a.empty() && snp.allele_b.empty();
+
+        // Alleles other than single characters never match a call
+        if (snp.allele_a.size() == 1) {
+            alleles[0] = snp.allele_a[0];
+            slots[(unsigned char) alleles[0]] = ALLELE_A;
+        }
+        if (snp.allele_b.size() == 1 && snp.allele_b != snp.allele_a) {
+            alleles[1] = snp.allele_b[0];
+            slots[(unsigned char) alleles[1]] = ALLELE_B;
+        }
+        // The missing character is a no-call even if it is also an allele
+        slots[(unsigned char) missing_genotype] = MISSING;
+    }
+
+    void genotype_encoder::add_allele(char allele) {
+        if (allele_count == 2) {
+            string found;
+            found += alleles[0];
+            found += alleles[1];
+            found += allele;
+            std::sort(found.begin(), found.end());
+
+            string list = "[";
+            for (size_t i = 0; i < found.size(); i++) {
+                if (i > 0) {
+                    list += ", ";
+                }
+                list += found[i];
+            }
+            list += "]";
+            throw malformed_data("Collated genotype was not bi-allelic: " +
+                                 list + " for SNP " + current.name);
+        }
+        alleles[allele_count] = allele;
+        slots[(unsigned char) allele] = ALLELE_A + allele_count;
+        allele_count++;
+    }
+
+    uint8_t genotype_encoder::encode_slow(const char *call) {
+        for (int i = 0; i < 2; i++) {
+            if (slots[(unsigned char) call[i]] == UNSEEN) {
+                if (!collating) {
+                    throw malformed_data("Unexpected call for SNP " +
+                                         current.name + " " +
+                                         current.allele_a +
+                                         current.allele_b + ": " +
+                                         string(call, 2));
+                }
+                add_allele(call[i]);
+            }
+        }
+
+        uint8_t a = slots[(unsigned char) call[0]];
+        uint8_t b = slots[(unsigned char) call[1]];
+        if (a == MISSING && b == MISSING) {
+            return 0;
+        }
+        if (a == MISSING || b == MISSING) {
+            throw malformed_data("Missing a call for only one allele for SNP " +
+                                 current.name + ": " + string(call, 2));
+        }
+        return a + b - 3;
+    }
+
+    void genotype_encoder::collated_alleles(snp &snp) const {
+        if (collating) {
+            snp.allele_a = allele_count > 0 ? string(1, alleles[0]) : "0";
+            snp.allele_b = allele_count > 1 ? string(1, alleles[1]) : "0";
+        }
+    }
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GFTOOLS_GENOTYPE_ENCODER_H
+#define GFTOOLS_GENOTYPE_ENCODER_H
+
+#include <string>
+#include <stdint.h>
+#include "snp.h"
+
+namespace gftools {
+    /** Encodes genotype calls of two characters, one per allele, into
+     * genotype call codes: 0 (no call), 1 (AA), 2 (AB or BA) and 3 (BB).
+     *
+     * Each character is looked up in a table of allele slots prepared once
+     * per SNP by set_snp, so that a call is encoded with two loads. Where
+     * the SNP has no alleles, they are collated from the calls in the same
+     * pass, in order of first appearance.
+     */
+    class genotype_encoder {
+private:
+        // Slots of characters in the table
+        static const uint8_t UNSEEN = 0;
+        static const uint8_t MISSING = 1;
+        static const uint8_t ALLELE_A = 2;
+        static const uint8_t ALLELE_B = 3;
+
+        char missing_genotype;
+        bool collating;
+        int allele_count;
+        char alleles[2];
+        uint8_t slots[256];
+        gftools::snp current;
+
+        uint8_t encode_slow(const char *call);
+
+        void add_allele(char allele);
+
+public:
+        /** Creates an encoder.
+         *
+         * @param missing_genotype The character of each allele of a
+         * no-call.
+         */
+        genotype_encoder(char missing_genotype = '0');
+
+        /** Prepares to encode the calls of a SNP. If the SNP has alleles,
+         * calls of any other allele are rejected. Otherwise the alleles
+         * are collated from the calls.
+         *
+         * @param snp A SNP.
+         */
+        void set_snp(const gftools::snp &snp);
+
+        /** Encodes one call of the current SNP. Throws malformed_data if
+         * only one allele is missing, if the call has an allele other than
+         * those of the SNP, or if it makes the collated alleles more than
+         * two.
+         *
+         * @param call The two characters of a call.
+         * @return A genotype call code.
+         */
+        uint8_t encode(const char *call) {
+            uint8_t a = slots[(unsigned char) call[0]];
+            uint8_t b = slots[(unsigned char) call[1]];
+            if (a >= ALLELE_A && b >= ALLELE_A) {
+                return a + b - 3;
+            }
+            return encode_slow(call);
+        }
+
+        /** Sets the alleles of a SNP to those collated from the calls
+         * encoded since set_snp, if the SNP had no alleles then. A missing
+         * allele is given as "0", as in collate_alleles.
+         *
+         * @param snp A SNP, updated.
+         */
+        void collated_alleles(gftools::snp &snp) const;
+    };
+}
+
+#endif // GFTOOLS_GENOTYPE_ENCODER_H
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "genotype_formatter.h"
+
+using std::string;
+using std::vector;
+
+namespace gftools {
+
+    genotype_formatter::genotype_formatter(const string &separator,
+                                           const string &allele_separator,
+                                           char missing_genotype)
+        : separator(separator), allele_separator(allele_separator),
+          missing_genotype(missing_genotype) {
+        set_snp(snp());
+    }
+
+    void genotype_formatter::set_snp(const snp &snp) {
+        string missing(1, missing_genotype);
+        calls[0] = separator + missing + allele_separator + missing;
+        calls[1] = separator + snp.allele_a + allele_separator + snp.allele_a;
+        calls[2] = separator + snp.allele_a + allele_separator + snp.allele_b;
+        calls[3] = separator + snp.allele_b + allele_separator + snp.allele_b;
+
+        max_length = 0;
+        for (int i = 0; i < 4; i++) {
+            max_length = std::max(max_length, calls[i].size());
+        }
+
+        short_form = max_length <= SHORT_CALL;
+        if (short_form) {
+            memset(short_calls, 0, sizeof(short_calls));
+            for (int i = 0; i < 4; i++) {
+                memcpy(short_calls[i], calls[i].data(), calls[i].size());
+            }
+        }
+    }
+
+    size_t genotype_formatter::buffer_size(size_t count) const {
+        return count * max_length + SHORT_CALL;
+    }
+
+    size_t genotype_formatter::format(const uint8_t *codes, size_t count,
+                                      char *buffer) const {
+        char *out = buffer;
+        if (short_form) {
+            // Copy a whole word for every call, then step over only the
+            // bytes of the call; the excess is overwritten by the next
+            size_t lengths[4];
+            for (int i = 0; i < 4; i++) {
+                lengths[i] = calls[i].size();
+            }
+            for (size_t i = 0; i < count; i++) {
+                int code = codes[i] & 3;
+                memcpy(out, short_calls[code], SHORT_CALL);
+                out += lengths[code];
+            }
+        }
+        else {
+            for (size_t i = 0; i < count; i++) {
+                const string &call = calls[codes[i] & 3];
+                memcpy(out, call.data(), call.size());
+                out += call.size();
+            }
+        }
+        return out - buffer;
+    }
+
+    void genotype_formatter::append(const vector<uint8_t> &codes,
+                                    vector<char> &buffer) const {
+        size_t used = buffer.size();
+        buffer.resize(used + buffer_size(codes.size()));
+        size_t n = codes.empty() ? 0 :
+            format(&codes[0], codes.size(), &buffer[used]);
+        buffer.resize(used + n);
+    }
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GFTOOLS_GENOTYPE_FORMATTER_H
+#define GFTOOLS_GENOTYPE_FORMATTER_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "snp.h"
+
+namespace gftools {
+    /** Formats genotype call codes as text directly into a byte buffer,
+     * without making a string per call.
+     *
+     * For each SNP, the text of the four possible calls is prepared once
+     * by set_snp. Each call is then written as a separator followed by
+     * its two alleles, optionally separated, e.g. " A G" in a TPED file or
+     * "\tAG" in a tab-separated matrix.
+     */
+    class genotype_formatter {
+private:
+        // Calls of up to this many bytes are copied as one word
+        static const size_t SHORT_CALL = 8;
+
+        std::string separator;
+        std::string allele_separator;
+        char missing_genotype;
+
+        std::string calls[4];
+        char short_calls[4][SHORT_CALL];
+        size_t max_length;
+        bool short_form;
+
+public:
+        /** Creates a formatter.
+         *
+         * @param separator Written before each call.
+         * @param allele_separator Written between the alleles of each call.
+         * @param missing_genotype The character written for each allele of
+         * a no-call.
+         */
+        genotype_formatter(const std::string &separator = "\t",
+                           const std::string &allele_separator = "",
+                           char missing_genotype = '0');
+
+        /** Prepares the text of the calls of a SNP, from its alleles.
+         *
+         * @param snp A SNP.
+         */
+        void set_snp(const gftools::snp &snp);
+
+        /** Returns the number of bytes of buffer that format may need for
+         * a number of calls of the current SNP, including slack for
+         * word-sized copies.
+         *
+         * @param count A number of calls.
+         */
+        size_t buffer_size(size_t count) const;
+
+        /** Writes the text of genotype calls of the current SNP.
+         *
+         * @param codes An array of genotype call codes, 0 to 3.
+         * @param count The number of calls.
+         * @param buffer An array of at least buffer_size(count) bytes.
+         * @return The number of bytes written, not counting slack.
+         */
+        size_t format(const uint8_t *codes, size_t count, char *buffer) const;
+
+        /** Appends the text of genotype calls of the current SNP to a
+         * buffer, which is grown as necessary.
+         *
+         * @param codes A vector of genotype call codes, 0 to 3.
+         * @param buffer A buffer of text.
+         */
+        void append(const std::vector<uint8_t> &codes,
+                    std::vector<char> &buffer) const;
+    };
+}
+
+#endif // GFTOOLS_GENOTYPE_FORMATTER_H
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "name_index.h"
+
+using std::string;
+using std::vector;
+
+// 64-bit FNV-1a
+static uint64_t hash_name(const char *name, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+namespace gftools {
+
+    size_t name_index::find_slot(const char *name, size_t length,
+                                 uint64_t hash) const {
+        size_t mask = slots.size() - 1;
+        size_t i = hash & mask;
+        while (slots[i] != -1) {
+            const entry &e = entries[slots[i]];
+            if (e.hash == hash && e.length == length &&
+                memcmp(arena.data() + e.offset, name, length) == 0) {
+                break;
+            }
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    void name_index::rehash(size_t capacity) {
+        slots.assign(capacity, -1);
+        size_t mask = capacity - 1;
+        for (size_t j = 0; j < entries.size(); j++) {
+            size_t i = entries[j].hash & mask;
+            while (slots[i] != -1) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = j;
+        }
+    }
+
+    void name_index::reserve(size_t names, size_t bytes) {
+        // Keep the table at most half full
+        size_t capacity = 16;
+        while (capacity < 2 * names) {
+            capacity *= 2;
+        }
+        if (capacity > slots.size()) {
+            rehash(capacity);
+        }
+        entries.reserve(names);
+        arena.reserve(bytes);
+    }
+
+    size_t name_index::insert(const string &name, int value) {
+        if (2 * (entries.size() + 1) > slots.size()) {
+            reserve(std::max((size_t) 16, 2 * entries.size()));
+        }
+
+        uint64_t hash = hash_name(name.data(), name.size());
+        size_t i = find_slot(name.data(), name.size(), hash);
+        if (slots[i] != -1) {
+            entries[slots[i]].value = value;
+            return entries[slots[i]].offset;
+        }
+
+        entry e;
+        e.hash = hash;
+        e.offset = arena.size();
+        e.length = name.size();
+        e.value = value;
+        arena.append(name);
+        slots[i] = entries.size();
+        entries.push_back(e);
+        return e.offset;
+    }
+
+    int name_index::find(const string &name) const {
+        if (entries.empty()) {
+            return -1;
+        }
+        uint64_t hash = hash_name(name.data(), name.size());
+        size_t i = find_slot(name.data(), name.size(), hash);
+        return slots[i] == -1 ? -1 : entries[slots[i]].value;
+    }
+
+    void name_index::clear() {
+        // Swap with empty containers, so that their memory is released
+        string().swap(arena);
+        vector<entry>().swap(entries);
+        vector<int32_t>().swap(slots);
+    }
+
+    size_t name_index::memory_usage() const {
+        return sizeof(*this) + arena.capacity() +
+            entries.capacity() * sizeof(entry) +
+            slots.capacity() * sizeof(int32_t);
+    }
+
+    // Saved as: the numbers of entries and slots and the arena length, each
+    // entry as four 64-bit words, the slots, then the arena
+    void name_index::save(string &out) const {
+        vector<uint64_t> words;
+        words.push_back(entries.size());
+        words.push_back(slots.size());
+        words.push_back(arena.size());
+        for (size_t i = 0; i < entries.size(); i++) {
+            words.push_back(entries[i].hash);
+            words.push_back(entries[i].offset);
+            words.push_back(entries[i].length);
+            words.push_back((int64_t) entries[i].value);
+        }
+        out.append((const char *) &words[0], words.size() * sizeof(uint64_t));
+        if (!slots.empty()) {
+            out.append((const char *) &slots[0], slots.size() * sizeof(int32_t));
+        }
+        out.append(arena);
+    }
+
+    bool name_index::load(const char *data, size_t len) {
+        clear();
+
+        uint64_t header[3];
+        if (len < sizeof(header)) {
+            return false;
+        }
+        memcpy(header, data, sizeof(header));
+        uint64_t n_entries = header[0], n_slots = header[1];
+        uint64_t arena_len = header[2];
+
+        // Bound each count by the length before multiplying
+        if (n_entries > len / 32 || n_slots > len / 4 || arena_len > len ||
+            (n_slots & (n_slots - 1)) || n_entries * 2 > n_slots ||
+            sizeof(header) + n_entries * 32 + n_slots * 4 + arena_len != len) {
+            return false;
+        }
+
+        const char *p = data + sizeof(header);
+        entries.resize(n_entries);
+        for (size_t i = 0; i < n_entries; i++, p += 32) {
+            uint64_t w[4];
+            memcpy(w, p, sizeof(w));
+            if (w[1] > arena_len || w[2] > arena_len - w[1]) {
+                clear();
+                return false;
+            }
+            entries[i].hash = w[0];
+            entries[i].offset = w[1];
+            entries[i].length = w[2];
+            entries[i].value = (int) (int64_t) w[3];
+        }
+
+        slots.resize(n_slots);
+        if (n_slots) {
+            memcpy(&slots[0], p, n_slots * sizeof(int32_t));
+        }
+        p += n_slots * sizeof(int32_t);
+        size_t used = 0;
+        for (size_t i = 0; i < n_slots; i++) {
+            if (slots[i] < -1 || slots[i] >= (int64_t) n_entries) {
+                clear();
+                return false;
+            }
+            used += slots[i] != -1;
+        }
+        if (used != n_entries) {
+            clear();
+            return false;
+        }
+
+        arena.assign(p, arena_len);
+        return true;
+    }
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GFTOOLS_NAME_INDEX_H
+#define GFTOOLS_NAME_INDEX_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace gftools {
+    /** An index of names, such as SNP names, to integer values.
+     *
+     * Names are copied once into a contiguous arena and looked up through
+     * an open-addressing hash table with linear probing, so that building
+     * the index makes no allocation per name and lookups compare strings
+     * only on a hash match.
+     */
+    class name_index {
+private:
+        struct entry {
+            uint64_t hash;
+            size_t offset; // of the name in the arena
+            size_t length;
+            int value;
+        };
+
+        std::string arena;
+        std::vector<entry> entries;
+        std::vector<int32_t> slots; // entry indices, or -1 if empty
+
+        size_t find_slot(const char *name, size_t length, uint64_t hash) const;
+
+        void rehash(size_t capacity);
+
+public:
+        /** Creates an empty index.
+         */
+        name_index() {}
+
+        /** Reserves space for a number of names, so that inserting them
+         * needs no rehashing.
+         *
+         * @param names The number of names.
+         * @param bytes The total length of the names, if known.
+         */
+        void reserve(size_t names, size_t bytes = 0);
+
+        /** Maps a name to a value, replacing any existing value.
+         *
+         * @param name A name.
+         * @param value The value.
+         * @return The offset of the name in names(), where it is stored
+         * once however many times it is inserted.
+         */
+        size_t insert(const std::string &name, int value);
+
+        /** Looks up a name, without inserting it.
+         *
+         * @param name A name.
+         * @return The value of the name, or -1 if it is not indexed.
+         */
+        int find(const std::string &name) const;
+
+        /** Returns the number of names indexed.
+         */
+        size_t size() const {
+            return entries.size();
+        }
+
+        /** Returns true if no names are indexed.
+         */
+        bool empty() const {
+            return entries.empty();
+        }
+
+        /** Returns the indexed names, packed end to end, for reading names
+         * by the offsets returned by insert.
+         */
+        const std::string &names() const {
+            return arena;
+        }
+
+        /** Removes all names, releasing their memory.
+         */
+        void clear();
+
+        /** Returns the approximate number of bytes used by the index.
+         */
+        size_t memory_usage() const;
+
+        /** Appends the index to a block of bytes, in a layout that load
+         * can restore without rehashing.
+         *
+         * @param out The block of bytes.
+         */
+        void save(std::string &out) const;
+
+        /** Replaces the index with one saved by save.
+         *
+         * @param data The saved bytes.
+         * @param len The number of saved bytes.
+         * @return false, leaving the index empty, if the bytes are not a
+         * consistent saved index.
+         */
+        bool load(const char *data, size_t len);
+    };
+}
+
+#endif // GFTOOLS_NAME_INDEX_H
@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <unistd.h>
+
+#include "exceptions.h"
+#include "utilities.h"
+#include "output_stage.h"
+
+using std::string;
+
+// Buffers are aligned to pages, as O_DIRECT and the page cache prefer
+const size_t BUFFER_ALIGN = 4096;
+
+namespace gftools {
+
+    output_stage::output_stage(int fd, size_t buffer_size, int buffers)
+        : fd(fd), buffer_size(buffer_size), started(false), stopping(false),
+          failed(false), filling(0), used(0), next(0), pending(0) {
+        if (buffers < 2) {
+            buffers = 2;
+        }
+        for (int i = 0; i < buffers; i++) {
+            void *buffer;
+            if (posix_memalign(&buffer, BUFFER_ALIGN, buffer_size) != 0) {
+                for (size_t j = 0; j < this->buffers.size(); j++) {
+                    free(this->buffers[j]);
+                }
+                throw std::bad_alloc();
+            }
+            this->buffers.push_back((unsigned char *) buffer);
+        }
+        lengths.resize(buffers);
+
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&changed, NULL);
+        // Without a thread, buffers are written on the calling thread
+        started = pthread_create(&thread, NULL, run_thread, this) == 0;
+    }
+
+    output_stage::~output_stage() {
+        try {
+            close();
+        }
+        catch (...) {}
+        for (size_t i = 0; i < buffers.size(); i++) {
+            free(buffers[i]);
+        }
+        pthread_cond_destroy(&changed);
+        pthread_mutex_destroy(&lock);
+    }
+
+    void *output_stage::run_thread(void *arg) {
+        ((output_stage *) arg)->run();
+        return NULL;
+    }
+
+    void output_stage::run() {
+        pthread_mutex_lock(&lock);
+        while (true) {
+            while (pending == 0 && !stopping) {
+                pthread_cond_wait(&changed, &lock);
+            }
+            if (pending == 0) {
+                break;
+            }
+            size_t i = next;
+            bool skip = failed;
+            pthread_mutex_unlock(&lock);
+
+            // After an error, queued buffers are discarded
+            const unsigned char *p = buffers[i];
+            size_t len = skip ? 0 : lengths[i];
+            string message;
+            while (len > 0) {
+                ssize_t n = ::write(fd, p, len);
+                if (n == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    message = "Failed to write output: " + error_message();
+                    break;
+                }
+                p += n;
+                len -= n;
+            }
+
+            pthread_mutex_lock(&lock);
+            if (!message.empty() && !failed) {
+                failed = true;
+                error = message;
+            }
+            next = (next + 1) % buffers.size();
+            pending--;
+            pthread_cond_broadcast(&changed);
+        }
+        pthread_mutex_unlock(&lock);
+    }
+
+    void output_stage::check_error() {
+        pthread_mutex_lock(&lock);
+        bool error = failed;
+        pthread_mutex_unlock(&lock);
+        if (error) {
+            throw malformed_data(this->error);
+        }
+    }
+
+    // Hands the current buffer to the I/O thread, then waits for the next
+    // buffer to be free
+    void output_stage::queue_buffer() {
+        if (!started) {
+            // No I/O thread; write directly
+            lengths[filling] = used;
+            pending = 1;
+            next = filling;
+            stopping = true;
+            run();
+            stopping = false;
+            used = 0;
+            check_error();
+            return;
+        }
+
+        pthread_mutex_lock(&lock);
+        lengths[filling] = used;
+        pending++;
+        pthread_cond_broadcast(&changed);
+        // After an error, wait for the queue to be discarded
+        while ((pending == buffers.size() && !failed) ||
+               (failed && pending > 0)) {
+            pthread_cond_wait(&changed, &lock);
+        }
+        bool error = failed;
+        pthread_mutex_unlock(&lock);
+
+        filling = error ? next : (filling + 1) % buffers.size();
+        used = 0;
+        if (error) {
+            throw malformed_data(this->error);
+        }
+    }
+
+    void output_stage::write(const void *data, size_t len) {
+        check_error();
+        const unsigned char *p = (const unsigned char *) data;
+        while (len > 0) {
+            if (used == buffer_size) {
+                queue_buffer();
+            }
+            size_t n = std::min(len, buffer_size - used);
+            memcpy(buffers[filling] + used, p, n);
+            used += n;
+            p += n;
+            len -= n;
+        }
+    }
+
+    unsigned char *output_stage::claim(size_t len) {
+        if (len > buffer_size) {
+            return NULL;
+        }
+        if (used + len > buffer_size) {
+            queue_buffer();
+        }
+        return buffers[filling] + used;
+    }
+
+    void output_stage::commit(size_t len) {
+        check_error();
+        used += len;
+    }
+
+    void output_stage::flush() {
+        if (used > 0) {
+            queue_buffer();
+        }
+        if (started) {
+            pthread_mutex_lock(&lock);
+            while (pending > 0) {
+                pthread_cond_wait(&changed, &lock);
+            }
+            pthread_mutex_unlock(&lock);
+        }
+        check_error();
+    }
+
+    void output_stage::close() {
+        if (!started) {
+            if (used > 0) {
+                queue_buffer();
+            }
+            return;
+        }
+
+        // Queue what is left, even after an error, so that the thread exits
+        pthread_mutex_lock(&lock);
+        if (used > 0) {
+            lengths[filling] = used;
+            pending++;
+            filling = (filling + 1) % buffers.size();
+            used = 0;
+        }
+        stopping = true;
+        pthread_cond_broadcast(&changed);
+        pthread_mutex_unlock(&lock);
+
+        pthread_join(thread, NULL);
+        started = false;
+        check_error();
+    }
+}
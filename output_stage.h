@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GFTOOLS_OUTPUT_STAGE_H
+#define GFTOOLS_OUTPUT_STAGE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+namespace gftools {
+    /** Buffers output to a file descriptor and writes it on a background
+     * thread, so that the producer can go on encoding while the filesystem
+     * absorbs the writes.
+     *
+     * Output is collected in a ring of large, page-aligned buffers. When a
+     * buffer is full it is queued for the I/O thread and the producer moves
+     * on to the next; if all the other buffers are still queued, the
+     * producer waits. A write error stops the I/O thread from writing
+     * further and is thrown as malformed_data by the next call to write,
+     * commit, flush or close.
+     */
+    class output_stage {
+private:
+        int fd;
+        size_t buffer_size;
+        std::vector<unsigned char *> buffers;
+        std::vector<size_t> lengths;
+
+        pthread_t thread;
+        pthread_mutex_t lock;
+        pthread_cond_t changed;
+        bool started;
+        bool stopping;
+        bool failed;
+        std::string error;
+        size_t filling; // the buffer being filled by the producer
+        size_t used;    // bytes in the buffer being filled
+        size_t next;    // the next buffer to be written by the I/O thread
+        size_t pending; // buffers queued for the I/O thread
+
+        void queue_buffer();
+
+        void check_error();
+
+        void run();
+
+        static void *run_thread(void *arg);
+
+        // Not copyable
+        output_stage(const output_stage &other);
+        output_stage &operator=(const output_stage &other);
+
+public:
+        /** Starts an output stage.
+         *
+         * @param fd A file descriptor open for writing, which is not closed
+         * by the stage.
+         * @param buffer_size The size of each buffer.
+         * @param buffers The number of buffers, at least 2.
+         */
+        output_stage(int fd, size_t buffer_size = 4 << 20, int buffers = 3);
+
+        /** Stops the stage, discarding any error. Call close to learn of
+         * errors.
+         */
+        ~output_stage();
+
+        /** Appends data to the output.
+         *
+         * @param data The data.
+         * @param len The length of the data.
+         */
+        void write(const void *data, size_t len);
+
+        /** Returns space for data in the current buffer, to be filled in
+         * place and then appended by commit.
+         *
+         * @param len The length of the data.
+         * @return The space, or NULL if len is larger than a buffer.
+         */
+        unsigned char *claim(size_t len);
+
+        /** Appends data written into the space returned by claim.
+         *
+         * @param len The length of the data, at most that claimed.
+         */
+        void commit(size_t len);
+
+        /** Waits until all the output so far has been written.
+         */
+        void flush();
+
+        /** Writes all the output and stops the I/O thread.
+         */
+        void close();
+    };
+}
+
+#endif // GFTOOLS_OUTPUT_STAGE_H
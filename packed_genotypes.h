@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GFTOOLS_PACKED_GENOTYPES_H
+#define GFTOOLS_PACKED_GENOTYPES_H
+
+#include <cstddef>
+
+namespace gftools {
+    /** A read-only view of the packed genotype calls of one SNP.
+     *
+     * The calls are stored as in a SNP-major BED file, four to a byte with
+     * the first individual in the two lowest bits. The view does not own its
+     * data and is only valid while the data it points to is.
+     */
+    class packed_genotypes {
+public:
+        /// The packed calls.
+        const unsigned char *data;
+        /// The number of calls, i.e. individuals.
+        size_t samples;
+
+        /** Creates an empty view.
+         */
+        packed_genotypes() {
+            data = NULL;
+            samples = 0;
+        }
+
+        /** Creates a view of packed calls.
+         *
+         * @param data The packed calls.
+         * @param samples The number of calls.
+         */
+        packed_genotypes(const unsigned char *data, size_t samples) {
+            this->data = data;
+            this->samples = samples;
+        }
+
+        /** Returns the number of bytes of packed data.
+         */
+        size_t bytes() const {
+            return (samples + 3) / 4;
+        }
+
+        /** Returns the integer code of one call.
+         *
+         * The codes are those used by plink_binary: 0 (no call), 1 (AA),
+         * 2 (AB) and 3 (BB).
+         *
+         * @param i The index of the individual.
+         * @return A genotype call code.
+         */
+        int call(size_t i) const {
+            static const int codes[4] = { 1, 0, 2, 3 };
+            return codes[(data[i / 4] >> (2 * (i % 4))) & 3];
+        }
+
+        /** Counts the calls of each genotype code.
+         *
+         * @param counts An array of four counts, indexed by genotype call
+         * code, which will be overwritten.
+         */
+        void count_calls(size_t counts[4]) const {
+            static const int codes[4] = { 1, 0, 2, 3 };
+            counts[0] = counts[1] = counts[2] = counts[3] = 0;
+
+            size_t full = samples / 4;
+            for (size_t i = 0; i < full; i++) {
+                unsigned char c = data[i];
+                counts[codes[c & 3]]++;
+                counts[codes[(c >> 2) & 3]]++;
+                counts[codes[(c >> 4) & 3]]++;
+                counts[codes[(c >> 6) & 3]]++;
+            }
+            for (size_t i = full * 4; i < samples; i++) {
+                counts[call(i)]++;
+            }
+        }
+    };
+
+    /** A read-only view of the packed genotype calls of a run of
+     * consecutive SNPs, as laid out in BED data.
+     */
+    class packed_snps {
+public:
+        /// The packed calls of the first SNP.
+        const unsigned char *data;
+        /// The number of SNPs.
+        size_t snps;
+        /// The number of calls per SNP, i.e. individuals.
+        size_t samples;
+
+        /** Creates an empty view.
+         */
+        packed_snps() {
+            data = NULL;
+            snps = 0;
+            samples = 0;
+        }
+
+        /** Creates a view of packed SNP records.
+         *
+         * @param data The packed calls of the first SNP.
+         * @param snps The number of SNPs.
+         * @param samples The number of calls per SNP.
+         */
+        packed_snps(const unsigned char *data, size_t snps, size_t samples) {
+            this->data = data;
+            this->snps = snps;
+            this->samples = samples;
+        }
+
+        /** Returns the number of bytes of packed data per SNP.
+         */
+        size_t bytes_per_snp() const {
+            return (samples + 3) / 4;
+        }
+
+        /** Returns a view of the calls of one SNP in the run.
+         *
+         * @param i The index of the SNP, relative to the first SNP.
+         */
+        packed_genotypes operator[](size_t i) const {
+            return packed_genotypes(data + i * bytes_per_snp(), samples);
+        }
+    };
+
+}
+
+#endif // GFTOOLS_PACKED_GENOTYPES_H
@@ -12,21 +12,42 @@
 #include <string>
 #include <iomanip>
 #include <set>
+#include <algorithm>
 #include <getopt.h>
+#include <pthread.h>
+#include "genotype_codec.h"
 #include "plink_binary.h"
+#include "utilities.h"
 
 using namespace std;
 
 void usage(char *progname);
 
+// counts of SNPs called in both samples and of matching calls for the
+// pairs whose first sample is in [first_row, end_row), over all the
+// selected SNPs; each thread fills its own slice of the shared arrays
+struct pair_slice {
+    const plink_binary *pb;
+    const vector<int> *snps;
+    int n_samples;
+    int first_row;
+    int end_row;
+    unsigned short *checked;
+    unsigned short *matched;
+    string error;
+};
+
+void *count_pairs(void *arg);
+
 int main (int argc, char *argv[])
 {
-    const char* const short_options = "d:n:r:f:m:";
+    const char* const short_options = "d:n:r:f:m:t:";
     const struct option long_options[] = {
         { "snp", 1, NULL, 'n' },
         { "full", 1, NULL, 'f' },
         { "summary", 1, NULL, 'm' },
         { "duplicate", 1, NULL, 'd' },
+        { "threads", 1, NULL, 't' },
         { NULL, 0, NULL, 0 }
     };
     int opt;
@@ -35,6 +56,7 @@ int main (int argc, char *argv[])
     string full_file("duplicate_full.txt");
     string summary_file("duplicate_summary.txt");
     float dup_threshold = 0.98;
+    int threads = 0;
 
     do {
         opt = getopt_long(argc, argv, short_options, long_options, NULL);
@@ -52,6 +74,9 @@ int main (int argc, char *argv[])
                 // duplicate = optarg;
                 break;
                 break;
+            case 't':
+                threads = atoi(optarg);
+                break;
         }
     } while (opt != -1);
 
@@ -68,7 +93,6 @@ int main (int argc, char *argv[])
 
     plink_binary *pb = new plink_binary(argv[optind]);
     vector<gftools::individual> samples = pb->individuals;
-    vector<int> genotypes;
     set <string> snps_to_check;
 
     ifstream snps;
@@ -84,38 +108,68 @@ int main (int argc, char *argv[])
     snps.close();
 
     int n_samples = samples.size();
-    int n_pairs = n_samples * (n_samples - 1) / 2;
-
-    vector <unsigned short> checked_for_pair, matched_for_pair;
-    checked_for_pair.resize(n_pairs);
-    matched_for_pair.resize(n_pairs);
-    for (int i = 0; i < n_pairs; i++) {
-        checked_for_pair[i] = matched_for_pair[i] = 0;
-    }
 
+    // each requested SNP is counted once, at its first occurrence
+    vector<int> selected;
     for (unsigned int snp = 0; snp < pb->snps.size(); snp++) {
         if (snps_to_check.size() == 0)
-            // terminate if all requested SNPs analysed
+            // terminate if all requested SNPs found
             break;
         // this SNP requested?
         if (snps_to_check.find(pb->snps[snp].name) != snps_to_check.end())
             snps_to_check.erase(pb->snps[snp].name);
         else
             continue;
-        pb->read_snp(snp, genotypes);
-
-        int pair = 0;
-        for (int ind_1 = 0; ind_1 < n_samples; ind_1++) {
-            for (int ind_2 = 1 + ind_1; ind_2 < n_samples; ind_2++) {
-                if (genotypes[ind_1] && genotypes[ind_2]) {
-                    checked_for_pair[pair]++;
-                    if (genotypes[ind_1] == genotypes[ind_2]){
-                      matched_for_pair[pair]++;
-                    }
-                }
+        selected.push_back(snp);
+    }
 
-                pair++;
-            }
+    size_t n_pairs = (size_t) n_samples * (n_samples - 1) / 2;
+    vector <unsigned short> checked_for_pair(n_pairs), matched_for_pair(n_pairs);
+
+    // Split the pairs, rather than the SNPs, between threads, so that the
+    // counts are held once however many threads there are. Each thread
+    // takes a run of first samples with about the same number of pairs.
+    if (threads < 1)
+        threads = gftools::cpu_count();
+    threads = max(1, min(threads, n_samples - 1));
+    vector<pair_slice> slices(threads);
+    unsigned short *checked = n_pairs ? &checked_for_pair[0] : NULL;
+    unsigned short *matched = n_pairs ? &matched_for_pair[0] : NULL;
+    size_t row_start = 0;
+    int row = 0;
+    for (int i = 0; i < threads; i++) {
+        pair_slice &slice = slices[i];
+        slice.pb = pb;
+        slice.snps = &selected;
+        slice.n_samples = n_samples;
+        slice.first_row = row;
+        slice.checked = checked + row_start;
+        slice.matched = matched + row_start;
+        size_t target = n_pairs * (i + 1) / threads;
+        while (row < n_samples && (row_start < target || i == threads - 1)) {
+            row_start += n_samples - 1 - row;
+            row++;
+        }
+        slice.end_row = row;
+    }
+
+    vector<pthread_t> ids(threads);
+    int started = 0;
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&ids[i], NULL, count_pairs, &slices[i]))
+            break;
+        started++;
+    }
+    count_pairs(&slices[0]);
+    for (int i = 1; i <= started; i++)
+        pthread_join(ids[i], NULL);
+    // any slices that could not be given a thread are counted here
+    for (int i = started + 1; i < threads; i++)
+        count_pairs(&slices[i]);
+    for (int i = 0; i < threads; i++) {
+        if (!slices[i].error.empty()) {
+            cerr << "Error: " << slices[i].error << endl;
+            exit (1);
         }
     }
 
@@ -145,8 +199,44 @@ int main (int argc, char *argv[])
     out_summary.close();
 }
 
+void *count_pairs(void *arg)
+{
+    pair_slice *slice = (pair_slice *) arg;
+    int n_samples = slice->n_samples;
+    vector<unsigned char> buffer;
+    vector<uint8_t> genotypes(n_samples);
+
+    try {
+        for (size_t i = 0; i < slice->snps->size(); i++) {
+            gftools::packed_genotypes view =
+                slice->pb->view_snp((*slice->snps)[i], buffer);
+            gftools::unpack_calls(view.data, n_samples, &genotypes[0]);
+
+            size_t pair = 0;
+            for (int ind_1 = slice->first_row; ind_1 < slice->end_row; ind_1++) {
+                for (int ind_2 = 1 + ind_1; ind_2 < n_samples; ind_2++) {
+                    if (genotypes[ind_1] && genotypes[ind_2]) {
+                        slice->checked[pair]++;
+                        if (genotypes[ind_1] == genotypes[ind_2]){
+                          slice->matched[pair]++;
+                        }
+                    }
+
+                    pair++;
+                }
+            }
+        }
+    }
+    catch (exception &e) {
+        slice->error = e.what();
+    }
+    return NULL;
+}
+
 void usage(char *progname)
 {
     cout << "Usage: " << progname << " [options] BED_FILE" << endl;
+    cout << "Options: -snp         file of SNP names to use" << endl;
+    cout << "         -threads     number of threads (default: one per CPU)" << endl;
 }
 
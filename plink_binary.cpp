@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
@@ -33,6 +34,10 @@
 #include <unistd.h>
 
 #include "utilities.h"
+#include "genotype_codec.h"
+#include "genotype_encoder.h"
+#include "plink_text.h"
+#include "sidecar.h"
 #include "plink_binary.h"
 
 using std::fstream;
@@ -45,7 +50,6 @@ using std::vector;
 using gftools::individual;
 using gftools::snp;
 using gftools::error_message;
-using gftools::at_eof;
 
 // final '1' for snp major mode; only supporting this at present
 #define MAGIC_LEN 3
@@ -53,51 +57,176 @@ static int magic_number[MAGIC_LEN] = { 108, 27, 1 };
 
 const char DEFAULT_MISSING_ALLELE = 'N';
 
-plink_binary::plink_binary(void) {
+// BED data is read in blocks of this size when not memory-mapped, aligned
+// as O_DIRECT requires
+const size_t READ_BLOCK_SIZE = 4 << 20;
+const size_t READ_BLOCK_ALIGN = 4096;
+
+plink_binary::plink_binary(void)
+    : open_for_write(false), bed_output(NULL), appending(false),
+      append_bed_size(0), append_bim_size(0), bim_fd(-1), bim_output(NULL),
+      snps_streamed(0), bed_claimed(false), is_mem_mapped(false), fmap(NULL),
+      flen(0), fd(-1), snp_ptr(0), bytes_per_snp(0), slot_fd(-1),
+      slot_capacity(0), slots_written(0), slot_lock(NULL), direct_fd(-1),
+      block_offset(0), block_pos(0), block_len(0) {
     // default "NN" for no call
     missing_genotype = DEFAULT_MISSING_ALLELE;
+    quell_mem_mapping = false;
+    direct_io = false;
+    use_sidecar = false;
+    compact_snps = false;
+    stream_bim = false;
 }
 
-plink_binary::plink_binary(string dataset) {
+plink_binary::plink_binary(string dataset)
+    : open_for_write(false), bed_output(NULL), appending(false),
+      append_bed_size(0), append_bim_size(0), bim_fd(-1), bim_output(NULL),
+      snps_streamed(0), bed_claimed(false), is_mem_mapped(false), fmap(NULL),
+      flen(0), fd(-1), snp_ptr(0), bytes_per_snp(0), slot_fd(-1),
+      slot_capacity(0), slots_written(0), slot_lock(NULL), direct_fd(-1),
+      block_offset(0), block_pos(0), block_len(0) {
     // default "NN" for no call
     missing_genotype = DEFAULT_MISSING_ALLELE;
+    quell_mem_mapping = false;
+    direct_io = false;
+    use_sidecar = false;
+    compact_snps = false;
+    stream_bim = false;
     // single argument: open as read (default)
     plink_binary::open(dataset);
 }
 
-plink_binary::~plink_binary() {}
+plink_binary::~plink_binary() {
+    // A dataset left open for writing, e.g. when an exception was thrown
+    // before close, is abandoned, which also stops its output stages
+    try {
+        abort();
+    }
+    catch (std::exception &e) {
+        // nothing more can be done about a failure to restore the files
+    }
+}
 
 void plink_binary::close() {
     if (open_for_write) {
-        if (individuals.size() == 0) {
-            throw gftools::malformed_data("No individuals to write");
-        }
-        write_fam(individuals);
-        if (snps.size() == 0) {
-            throw gftools::malformed_data("No SNPs to write");
+        string error = close_bed_output();
+        string bim_error = close_bim_stream();
+        string bim_file = bim_stream;
+        bim_stream.clear();
+        close_slots();
+        if (error.empty()) {
+            error = bim_error;
         }
-        write_bim(snps);
 
-        if (bed_file->is_open()) {
-            bed_file->close();
+        if (appending) {
+            appending = false;
+            if (!error.empty()) {
+                // Leave the dataset as it was
+                if (!restore_appended(bim_file)) {
+                    error += "; failed to restore the original files: " +
+                        error_message();
+                }
+                throw gftools::malformed_data(error);
+            }
+        }
+        else {
+            // A failed close leaves no temporary BIM file behind
+            try {
+                close_new_dataset(error, bim_file);
+            }
+            catch (...) {
+                if (!bim_file.empty()) {
+                    unlink(bim_file.c_str());
+                }
+                throw;
+            }
         }
-        delete bed_file;
     }
     else {
         if (is_mem_mapped) {
             munmap(fmap, flen);
-            ::close(fd);
         }
-        else {
-            if (bed_file->is_open()) {
-                bed_file->close();
-            }
-            delete bed_file;
+        if (direct_fd != -1) {
+            ::close(direct_fd);
         }
+        ::close(fd);
     }
     individuals.resize(0);
     snps.resize(0);
+    snp_columns.clear();
     snp_index.clear();
+    subset = gftools::sample_subset();
+    regions = gftools::region_index();
+    chromosome_codes.clear();
+    chromosome_runs.clear();
+}
+
+// Writes the FAM and BIM files of a new dataset once its BED file has been
+// closed, throwing any error in closing that
+void plink_binary::close_new_dataset(const string &error,
+                                     const string &bim_file) {
+    if (!error.empty()) {
+        throw gftools::malformed_data(error);
+    }
+    if (individuals.size() == 0) {
+        throw gftools::malformed_data("No individuals to write");
+    }
+    write_fam(individuals);
+
+    if (bim_file.empty()) {
+        if (snps.size() == 0) {
+            throw gftools::malformed_data("No SNPs to write");
+        }
+        write_bim(snps);
+    }
+    else {
+        if (snps_streamed == 0) {
+            throw gftools::malformed_data("No SNPs to write");
+        }
+        string fn = dataset + ".bim";
+        if (rename(bim_file.c_str(), fn.c_str()) == -1) {
+            throw gftools::malformed_data("Failed to rename BIM file for " +
+                                          dataset + ": " + error_message());
+        }
+    }
+}
+
+void plink_binary::abort() {
+    if (!open_for_write || !bed_output) {
+        return;
+    }
+    open_for_write = 0;
+    close_bed_output();
+    close_bim_stream();
+    string bim_file = bim_stream;
+    bim_stream.clear();
+    try {
+        close_slots();
+    }
+    catch (std::exception &e) {
+        // a slot left unwritten is of no concern here
+    }
+    individuals.resize(0);
+    snps.resize(0);
+
+    if (appending) {
+        appending = false;
+        if (!restore_appended(bim_file)) {
+            throw gftools::malformed_data("Failed to restore the original "
+                                          "files of " + dataset + ": " +
+                                          error_message());
+        }
+    }
+    else if (!bim_file.empty()) {
+        unlink(bim_file.c_str());
+    }
+}
+
+// Cuts the BED and BIM files of an appended dataset back to their lengths
+// before appending, returning false on failure
+bool plink_binary::restore_appended(const string &bim_file) {
+    return truncate((dataset + ".bed").c_str(), append_bed_size) == 0 &&
+        truncate(bim_file.c_str(), append_bim_size) == 0;
 }
 
 void plink_binary::open(string dataset) {
@@ -110,215 +239,446 @@ void plink_binary::open(string dataset, bool mode) {
 
 void plink_binary::init(string dataset, bool mode) {
     this->dataset = dataset;
-    quell_mem_mapping = false;
     if (mode) {
         open_for_write = 1;
         open_bed_write(dataset + ".bed");
+        if (stream_bim) {
+            open_bim_stream();
+        }
     }
     else {
         open_for_write = 0;
-        read_bim(snps);
-        if (snps.empty()) {
-            throw gftools::malformed_data("No SNPs read");
+        // Stamp the sources before reading them, so that a sidecar is not
+        // written for files that change meanwhile
+        gftools::source_stamps stamps;
+        bool sidecar = use_sidecar && stamps.take(dataset);
+        if (sidecar && gftools::read_sidecar(dataset, stamps, snp_columns,
+                                             individuals, regions)) {
+            if (!compact_snps) {
+                snps.resize(snp_columns.size());
+                for (size_t i = 0; i < snps.size(); i++) {
+                    snp_columns.get(i, snps[i]);
+                }
+                snp_index = snp_columns.name_lookup();
+                snp_columns.clear();
+            }
         }
-        read_fam(individuals);
-        if (individuals.empty()) {
-            throw gftools::malformed_data("No individuals read");
+        else {
+            read_bim(snps);
+            if (snps.empty()) {
+                throw gftools::malformed_data("No SNPs read");
+            }
+            read_fam(individuals);
+            if (individuals.empty()) {
+                throw gftools::malformed_data("No individuals read");
+            }
+            if (compact_snps || sidecar) {
+                snp_columns = gftools::snp_table(snps);
+            }
+            if (sidecar) {
+                regions = gftools::region_index(snp_columns);
+                gftools::write_sidecar(dataset, stamps, snp_columns,
+                                       individuals, regions);
+            }
+            if (compact_snps) {
+                // The table indexes the names itself
+                vector<snp>().swap(snps);
+                snp_index.clear();
+            }
+            else {
+                snp_columns.clear();
+            }
         }
+        index_chromosomes();
         bytes_per_snp = (3 + individuals.size()) / 4;
         open_bed_read(dataset + ".bed", quell_mem_mapping);
     }
 }
 
+size_t plink_binary::snp_count() const {
+    if (!bim_stream.empty()) {
+        return snps_streamed;
+    }
+    return snp_columns.empty() ? snps.size() : snp_columns.size();
+}
+
+void plink_binary::snp_at(int snp_index, snp &snp) const {
+    if (snp_columns.empty()) {
+        snp = snps.at(snp_index);
+    }
+    else {
+        snp_columns.get(snp_index, snp);
+    }
+}
+
+int plink_binary::find_snp(const string &name) const {
+    return snp_columns.empty() ? snp_index.find(name) : snp_columns.find(name);
+}
+
+void plink_binary::index_chromosomes() {
+    size_t n = snp_count();
+    chromosome_codes.resize(n);
+    chromosome_runs.assign(gftools::MAX_CHROMOSOME + 1,
+                           vector<gftools::snp_range>());
+
+    // BIM files are normally sorted by chromosome, so parse each name once
+    const string *last = NULL;
+    int code = 0;
+    for (size_t i = 0; i < n; i++) {
+        const string &name = snp_columns.empty() ? snps[i].chromosome :
+            snp_columns.chromosome(i);
+        if (!last || name != *last) {
+            code = gftools::chromosome_code(name);
+            last = &name;
+        }
+        chromosome_codes[i] = code;
+
+        vector<gftools::snp_range> &runs = chromosome_runs[code];
+        if (!runs.empty() && runs.back().first + runs.back().count == (int) i) {
+            runs.back().count++;
+        }
+        else {
+            runs.push_back(gftools::snp_range(i, 1));
+        }
+    }
+}
+
+unsigned int plink_binary::snp_class(int snp_index) const {
+    return gftools::chromosome_class(chromosome_codes.at(snp_index));
+}
+
+const vector<gftools::snp_range> &
+plink_binary::chromosome_ranges(int code) const {
+    static const vector<gftools::snp_range> none;
+    if (code < 0 || (size_t) code >= chromosome_runs.size()) {
+        return none;
+    }
+    return chromosome_runs[code];
+}
+
 bool plink_binary::next_snp(snp &snp, vector<string> &genotypes) {
-    vector<int> gt_int;
-    if (snp_ptr >= snps.size()) {
+    if (snp_ptr >= snp_count()) {
+        return false;
+    }
+
+    call_buffer.resize(call_count());
+    unpack_snp(snp_data(snp_ptr, 1), &call_buffer[0]);
+    snp_at(snp_ptr++, snp);
+    genotypes_itoa(snp, call_buffer, genotypes);
+    return true;
+}
+
+bool plink_binary::next_snp(snp &snp, vector<int> &genotypes) {
+    if (snp_ptr >= snp_count()) {
+        return false;
+    }
+
+    genotypes.resize(call_count());
+    unpack_snp(snp_data(snp_ptr, 1), &genotypes[0]);
+    snp_at(snp_ptr++, snp);
+    return true;
+}
+
+bool plink_binary::next_snp(snp &snp, vector<uint8_t> &genotypes) {
+    if (snp_ptr >= snp_count()) {
         return false;
     }
 
-    get_snp(3 + snp_ptr * bytes_per_snp, gt_int);
-    genotypes_itoa(snps[snp_ptr], gt_int, genotypes);
-    snp = snps[snp_ptr++];
+    genotypes.resize(call_count());
+    unpack_snp(snp_data(snp_ptr, 1), &genotypes[0]);
+    snp_at(snp_ptr++, snp);
     return true;
 }
 
 void plink_binary::read_snp(string snp, vector<string> &genotypes) {
-    vector<int> gt_int;
-    int index = snp_index[snp];
-    read_snp(3 + index * bytes_per_snp, gt_int);
-    genotypes_itoa(snps[index], gt_int, genotypes);
+    int index = find_snp(snp);
+    if (index == -1) {
+        throw gftools::malformed_data("No SNP named '" + snp + "' in " +
+                                      dataset);
+    }
+    call_buffer.resize(call_count());
+    unpack_snp(snp_data(index, 1), &call_buffer[0]);
+    snp_at(index, snp_buffer);
+    genotypes_itoa(snp_buffer, call_buffer, genotypes);
     snp_ptr = index + 1;
 }
 
-void plink_binary::genotypes_itoa(snp snp, const vector<int> g_num, vector<string> &g_str) {
-    g_str.resize(0);
-
-    for (vector<int>::const_iterator i = g_num.begin(); i < g_num.end(); i++) {
-        string genotype;
-        string missing = string(2, missing_genotype);
-        switch (*i) {
-            case 0: genotype = missing; break;
-            case 1: genotype = snp.allele_a + snp.allele_a; break;
-            case 2: genotype = snp.allele_a + snp.allele_b; break;
-            case 3: genotype = snp.allele_b + snp.allele_b; break;
-            default: throw gftools::malformed_data("integer genotypes must be 0..3");
+// Translates genotype call codes of any integer type to strings
+template <typename T>
+static void format_genotypes(const snp &snp, char missing_genotype,
+                             const vector<T> &g_num, vector<string> &g_str) {
+    // Only four genotypes are possible, indexed by code
+    string genotypes[4];
+    genotypes[0].assign(2, missing_genotype);
+    genotypes[1].assign(snp.allele_a).append(snp.allele_a);
+    genotypes[2].assign(snp.allele_a).append(snp.allele_b);
+    genotypes[3].assign(snp.allele_b).append(snp.allele_b);
+
+    // Existing strings are reassigned in place, reusing their storage
+    g_str.resize(g_num.size());
+
+    for (size_t i = 0; i < g_num.size(); i++) {
+        int code = g_num[i];
+        if (code < 0 || code > 3) {
+            throw gftools::malformed_data("integer genotypes must be 0..3");
         }
-        g_str.push_back(genotype);
+        g_str[i] = genotypes[code];
     }
 }
 
-void plink_binary::genotypes_atoi(gftools::snp &snp, const vector<string> g_str, vector<int> &g_num) {
-    vector<string> alleles = collate_alleles(g_str);
-    string a = alleles[0];
-    string b = alleles[1];
-    string missing = string(1, missing_genotype);
-    string no_call = string(2, missing_genotype);
+void plink_binary::genotypes_itoa(const snp &snp, const vector<int> &g_num, vector<string> &g_str) const {
+    format_genotypes(snp, missing_genotype, g_num, g_str);
+}
 
-    std::map<string, int> lookup;
-    if ((a == missing && b != missing) || (a != missing && b == missing)) {
-        throw gftools::malformed_data("Missing a call for only one allele");
-    }
-    else {
-        // Strand is being normalised here, for heterozygotes
-        lookup[no_call] = 0;
-        lookup[snp.allele_a + snp.allele_a] = 1;
-        lookup[snp.allele_a + snp.allele_b] = 2;
-        lookup[snp.allele_b + snp.allele_a] = 2;
-        lookup[snp.allele_b + snp.allele_b] = 3;
-    }
+void plink_binary::genotypes_itoa(const snp &snp, const vector<uint8_t> &g_num, vector<string> &g_str) const {
+    format_genotypes(snp, missing_genotype, g_num, g_str);
+}
+
+void plink_binary::genotypes_atoi(gftools::snp &snp, const vector<string> &g_str, vector<int> &g_num) {
+    vector<uint8_t> codes;
+    genotypes_atoi(snp, g_str, codes);
+    g_num.insert(g_num.end(), codes.begin(), codes.end());
+}
+
+void plink_binary::genotypes_atoi(gftools::snp &snp, const vector<string> &g_str, vector<uint8_t> &g_num) {
+    gftools::genotype_encoder encoder(missing_genotype);
+    encoder.set_snp(snp);
 
-    for (vector<string>::const_iterator i = g_str.begin(); i < g_str.end(); i++) {
-        string call = *i;
-        if (snp.is_known() && lookup.count(call) == 0) {
-            throw gftools::malformed_data("Unexpected call for SNP " +
-                                          snp.name + " " +
-                                          snp.allele_a + snp.allele_b +
-                                          ": " + call);
+    size_t n = g_num.size();
+    g_num.resize(n + g_str.size());
+    for (size_t i = 0; i < g_str.size(); i++) {
+        if (g_str[i].length() != 2) {
+            throw gftools::malformed_data("Unrecognised genotype " + g_str[i]);
         }
-        g_num.push_back(lookup[call]);
+        g_num[n + i] = encoder.encode(g_str[i].data());
     }
+    encoder.collated_alleles(snp);
 }
 
 vector<string> plink_binary::collate_alleles(const vector<string> &g_str) {
+    // Collate as genotypes_atoi does when writing a SNP without alleles
+    gftools::snp snp;
+    gftools::genotype_encoder encoder(missing_genotype);
+    encoder.set_snp(snp);
+    for (size_t i = 0; i < g_str.size(); i++) {
+        if (g_str[i].length() != 2) {
+            throw gftools::malformed_data("Unrecognised genotype " + g_str[i]);
+        }
+        encoder.encode(g_str[i].data());
+    }
+    encoder.collated_alleles(snp);
+
     vector<string> alleles;
+    alleles.push_back(snp.allele_a);
+    alleles.push_back(snp.allele_b);
+    return alleles;
+}
 
-    if (!g_str.empty()) {
-        string allele_a = "0";
-        string allele_b = "0";
-        std::set<string> alleles_ab;
-        string missing = string(1, missing_genotype);
-
-        vector<string>::const_iterator gi;
-        for (gi = g_str.begin(); gi < g_str.end(); gi++) {
-            string call = *gi;
-
-            if (call.length() == 2) {
-                string a = call.substr(0, 1);
-                string b = call.substr(1, 2);
-
-                if (a != missing) {
-                    if (allele_a == "0") {
-                        allele_a = a;
-                    }
-                    else if (allele_a != a && allele_a != allele_b && a != b) {
-                        throw gftools::malformed_data("Ambiguous allele A in " +
-                                                      call + " of " +
-                                                      call_str(g_str));
-                    }
-                    alleles_ab.insert(a);
-                }
+void plink_binary::read_snp(int snp_index, vector<int> &genotypes) const {
+    get_snp(snp_index, genotypes);
+}
 
-                if (b != missing) {
-                    if (allele_b == "0") {
-                        allele_b = b;
-                    }
-                    else if (allele_b != b && allele_a != allele_b && a != b) {
-                        throw gftools::malformed_data("Ambiguous allele B in " +
-                                                      call + " of " +
-                                                      call_str(g_str));
-                    }
-                    alleles_ab.insert(b);
-                }
+void plink_binary::read_snp(int snp_index, vector<uint8_t> &genotypes) const {
+    get_snp(snp_index, genotypes);
+}
+
+gftools::packed_genotypes plink_binary::view_snp(int snp) {
+    return gftools::packed_genotypes(snp_data(snp, 1), individuals.size());
+}
+
+gftools::packed_genotypes plink_binary::view_snp(int snp,
+                                                 vector<unsigned char> &buffer) const {
+    return gftools::packed_genotypes(bed_data(snp, 1, buffer),
+                                     individuals.size());
+}
+
+gftools::packed_snps plink_binary::view_snps(int first, int count) {
+    return gftools::packed_snps(snp_data(first, count), count,
+                                individuals.size());
+}
+
+gftools::packed_snps plink_binary::view_snps(int first, int count,
+                                             vector<unsigned char> &buffer) const {
+    return gftools::packed_snps(bed_data(first, count, buffer), count,
+                                individuals.size());
+}
+
+void plink_binary::read_snps(int first, int count, vector<uint8_t> &matrix,
+                             bool sample_major) const {
+    matrix.resize((size_t) count * call_count());
+    if (!matrix.empty()) {
+        read_snps(first, count, &matrix[0], sample_major);
+    }
+}
+
+void plink_binary::read_snps(int first, int count, uint8_t *matrix,
+                             bool sample_major) const {
+    vector<unsigned char> buffer; // only used if not memory-mapped
+    gftools::packed_snps view = view_snps(first, count, buffer);
+    size_t n = individuals.size();
+
+    if (!sample_major) {
+        n = call_count();
+        for (int j = 0; j < count; j++) {
+            unpack_snp(view[j].data, matrix + j * n);
+        }
+        return;
+    }
+
+    const size_t snp_tile = 64;
+
+    if (!subset.empty()) {
+        // Decode the subset of a tile of SNPs, then transpose
+        n = subset.size();
+        vector<uint8_t> rows(snp_tile * n);
+        for (size_t j0 = 0; j0 < (size_t) count; j0 += snp_tile) {
+            size_t nj = std::min(snp_tile, count - j0);
+            for (size_t j = 0; j < nj; j++) {
+                subset.extract(view[j0 + j].data, &rows[j * n]);
             }
-            else {
-                throw gftools::malformed_data("Unrecognised genotype " + call);
+            for (size_t s = 0; s < n; s++) {
+                uint8_t *out = matrix + s * count + j0;
+                for (size_t j = 0; j < nj; j++) {
+                    out[j] = rows[j * n + s];
+                }
             }
         }
+        return;
+    }
+
+    // Transpose through a tile small enough to stay in L1 cache. Sample
+    // tiles start on a byte boundary of the packed data.
+    const size_t sample_tile = 256;
+    uint8_t tile[snp_tile * sample_tile];
 
-        if (alleles_ab.size() > 2) {
-             std::stringstream ss;
-             ss << "[";
+    for (size_t s0 = 0; s0 < n; s0 += sample_tile) {
+        size_t ns = std::min(sample_tile, n - s0);
 
-             std::set<string>::const_iterator ai;
-             for (ai = alleles_ab.begin(); ai != alleles_ab.end(); ai++) {
-               if (ai != alleles_ab.begin()) {
-                 ss << ", ";
-               }
-               ss << *ai;
-             }
-             ss << "]";
+        for (size_t j0 = 0; j0 < (size_t) count; j0 += snp_tile) {
+            size_t nj = std::min(snp_tile, count - j0);
 
-            throw gftools::malformed_data("Collated genotype was not bi-allelic: " +
-                                          ss.str());
+            for (size_t j = 0; j < nj; j++) {
+                gftools::unpack_calls(view[j0 + j].data + s0 / 4, ns,
+                                      tile + j * sample_tile);
+            }
+            for (size_t s = 0; s < ns; s++) {
+                uint8_t *out = matrix + (s0 + s) * count + j0;
+                for (size_t j = 0; j < nj; j++) {
+                    out[j] = tile[j * sample_tile + s];
+                }
+            }
         }
+    }
+}
 
-        alleles.push_back(allele_a);
+void plink_binary::find_region(const string &chromosome, int start, int end,
+                               vector<gftools::snp_range> &ranges) {
+    if (regions.empty()) {
+        regions = snp_columns.empty() ? gftools::region_index(snps) :
+            gftools::region_index(snp_columns);
+    }
+    regions.find(chromosome, start, end, ranges);
+}
 
-        // This seems arbitrary. If you have only homozygous calls,
-        // how do you know whether this is allele A or B, without
-        // reference to the annotation? I'm copying the implementation
-        // in the original code, but I
-        if (alleles_ab.size() == 1) {
-            alleles.push_back("0");
-        }
-        else {
-            alleles.push_back(allele_b);
+void plink_binary::keep_samples(const vector<int> &indices) {
+    // An empty subset means all individuals, so keeping none is refused
+    // rather than silently keeping them all
+    if (indices.empty()) {
+        throw gftools::malformed_data("No individuals to keep in " + dataset +
+                                      "; use keep_all_samples to keep all");
+    }
+    subset = gftools::sample_subset(indices, individuals.size());
+}
+
+void plink_binary::keep_samples(const vector<string> &names) {
+    std::map<string, int> index;
+    for (size_t i = 0; i < individuals.size(); i++) {
+        index.insert(std::make_pair(individuals[i].name, (int) i));
+    }
+
+    vector<int> indices;
+    for (size_t i = 0; i < names.size(); i++) {
+        std::map<string, int>::const_iterator it = index.find(names[i]);
+        if (it == index.end()) {
+            throw gftools::malformed_data("No individual named '" + names[i] +
+                                          "' in " + dataset);
         }
+        indices.push_back(it->second);
     }
+    keep_samples(indices);
+}
 
-    return alleles;
+void plink_binary::keep_all_samples() {
+    subset = gftools::sample_subset();
+}
+
+size_t plink_binary::call_count() const {
+    return subset.empty() ? individuals.size() : subset.size();
 }
 
-void plink_binary::read_snp(int snp_index, vector<int> &genotypes) {
-    get_snp(3 + snp_index * bytes_per_snp, genotypes);
+void plink_binary::decode_calls(const gftools::packed_genotypes &packed,
+                                uint8_t *calls) const {
+    unpack_snp(packed.data, calls);
+}
+
+void plink_binary::prefetch_snps(int first, int count) const {
+    check_snp_range(first, count);
+
+    size_t pos = MAGIC_LEN + (size_t) first * bytes_per_snp;
+    size_t len = (size_t) count * bytes_per_snp;
+    if (len == 0) {
+        return;
+    }
+
+    if (is_mem_mapped) {
+        if (pos >= flen) {
+            return;
+        }
+        // madvise needs a page-aligned start
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t start = pos - pos % page;
+        madvise(fmap + start, std::min(pos + len, flen) - start,
+                MADV_WILLNEED);
+    }
+    else {
+        posix_fadvise(fd, pos, len, POSIX_FADV_WILLNEED);
+    }
 }
 
 snp plink_binary::from_bim(string record) {
-    stringstream ss(record);
     snp snp;
-    ss >> snp.chromosome;
-    ss >> snp.name;
-    ss >> snp.genetic_position;
-    ss >> snp.physical_position;
-    ss >> snp.allele_a;
-    ss >> snp.allele_b;
+    gftools::parse_bim_record(record.data(), record.data() + record.size(), snp);
     return snp;
 }
 
-string plink_binary::to_bim(snp snp) {
-    stringstream record;
-    record << (snp.chromosome.length() ? snp.chromosome : "0");
-    record << "\t" << snp.name;
-    record << "\t" << (snp.genetic_position ? snp.genetic_position : 0);
-    record << "\t" << (snp.physical_position ? snp.physical_position : 0);
-    record << "\t" << snp.allele_a;
-    record << "\t" << snp.allele_b;
-    return record.str();
+// Appends a BIM record to a string, without a line end
+static void append_bim(const snp &snp, string &record) {
+    char positions[32];
+    snprintf(positions, sizeof(positions), "\t%d\t%d\t",
+             snp.genetic_position, snp.physical_position);
+
+    record += snp.chromosome.length() ? snp.chromosome : "0";
+    record += '\t';
+    record += snp.name;
+    record += positions;
+    record += snp.allele_a;
+    record += '\t';
+    record += snp.allele_b;
+}
+
+string plink_binary::to_bim(const snp &snp) {
+    string record;
+    append_bim(snp, record);
+    return record;
 }
 
 individual plink_binary::from_fam(string record) {
-    stringstream ss(record, stringstream::in | stringstream::out);
     gftools::individual ind;
-    ss >> ind.family;
-    ss >> ind.name;
-    ss >> ind.father;
-    ss >> ind.mother;
-    ss >> ind.sex;
-    ss >> ind.phenotype;
+    gftools::parse_fam_record(record.data(), record.data() + record.size(), ind);
     return ind;
 }
 
-string plink_binary::to_fam(individual ind) {
+string plink_binary::to_fam(const individual &ind) {
     stringstream record;
     record << (ind.family.length() ? ind.family : ind.name);
     record << "\t" << ind.name;
@@ -329,7 +689,7 @@ string plink_binary::to_fam(individual ind) {
     return record.str();
 }
 
-void plink_binary::write_bim(const vector<snp> snps) {
+void plink_binary::write_bim(const vector<snp> &snps) {
     ofstream file;
     string fn = dataset + ".bim";
     file.open(fn.c_str(), fstream::out);
@@ -342,33 +702,34 @@ void plink_binary::write_bim(const vector<snp> snps) {
 }
 
 void plink_binary::read_bim(vector<snp> &snps) {
-    ifstream file;
     string fn = dataset + ".bim";
-    file.open(fn.c_str());
+    gftools::mapped_file file;
 
-    if (!file) {
+    if (!file.open(fn)) {
         throw gftools::malformed_data("Failed to open BIM file for " + dataset +
                                       ": " + error_message());
     }
     else {
-        if (at_eof(file)) {
+        if (file.size() == 0) {
             throw gftools::malformed_data("Empty BIM file for " + dataset);
         }
     }
 
-    string str;
-    int i = 0;
+    gftools::parse_bim(file.data(), file.size(), snps);
+    file.close();
 
-    while (getline(file, str)) {
-        snp snp = from_bim(str);
-        snps.push_back(snp);
-        snp_index[snp.name] = i++;
+    // Index once the size is known; where names repeat, the last wins
+    size_t bytes = 0;
+    for (size_t i = 0; i < snps.size(); i++) {
+        bytes += snps[i].name.size();
+    }
+    snp_index.reserve(snps.size(), bytes);
+    for (size_t i = 0; i < snps.size(); i++) {
+        snp_index.insert(snps[i].name, i);
     }
-
-    file.close();
 }
 
-void plink_binary::write_fam(const vector<individual> individuals) {
+void plink_binary::write_fam(const vector<individual> &individuals) {
     ofstream file;
     string fn = dataset + ".fam";
     file.open(fn.c_str(), fstream::out);
@@ -381,63 +742,160 @@ void plink_binary::write_fam(const vector<individual> individuals) {
 }
 
 void plink_binary::read_fam(vector<individual> &individuals) {
-    ifstream file;
     string fn = dataset + ".fam";
-    file.open(fn.c_str());
-    if (!file.is_open()) {
+    gftools::mapped_file file;
+    if (!file.open(fn)) {
         throw gftools::malformed_data("Missing FAM file for " + dataset);
     }
 
-    string str;
-    int i = 0;
-    while (getline(file, str)) {
-        individual ind = from_fam(str);
-        individuals.push_back(ind);
-        i++;
-    }
-
+    gftools::parse_fam(file.data(), file.size(), individuals);
     file.close();
 }
 
 void plink_binary::open_bed_write(string filename) {
-    bed_file = new fstream();
-    bed_file->open(filename.c_str(), fstream::out | fstream::binary);
+    fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1) {
+        throw gftools::malformed_data("Failed to open BED file for " +
+                                      dataset + ": " + error_message());
+    }
+    start_bed_output();
+    write_bed_header();
+}
+
+// Starts writing BED data at the current offset of fd
+void plink_binary::start_bed_output() {
+    bed_output = new gftools::output_stage(fd);
+    bed_claimed = false;
+    bim_output = NULL;
+    bim_fd = -1;
+    snps_streamed = 0;
+    appending = false;
 
     // in theory can use mmap here but you'd have to declare the
     // snps (or at least the snp count) before opening. as most
     // files will likely be opened for reading, (yet) supported
     is_mem_mapped = 0;
+    direct_fd = -1;
+    slot_fd = -1;
+    slot_capacity = slots_written = 0;
+    slot_written.clear();
+    slot_lock = NULL;
+}
 
-    write_bed_header();
+void plink_binary::open_append(string dataset) {
+    this->dataset = dataset;
+    individuals.clear();
+    snps.clear();
+    read_fam(individuals);
+    if (individuals.empty()) {
+        throw gftools::malformed_data("No individuals read");
+    }
+    bytes_per_snp = (3 + individuals.size()) / 4;
+
+    // Count the BIM records, one per line as read_bim does, without
+    // parsing them
+    string bim = dataset + ".bim";
+    gftools::mapped_file file;
+    if (!file.open(bim)) {
+        throw gftools::malformed_data("Failed to open BIM file for " + dataset +
+                                      ": " + error_message());
+    }
+    const char *p = file.data();
+    const char *end = p + file.size();
+    size_t records = 0;
+    while ((p = (const char *) memchr(p, '\n', end - p))) {
+        records++;
+        p++;
+    }
+    bool unterminated = file.size() > 0 && end[-1] != '\n';
+    records += unterminated;
+    append_bim_size = file.size();
+    file.close();
+
+    string bed = dataset + ".bed";
+    int bed_fd = ::open(bed.c_str(), O_RDWR);
+    if (bed_fd == -1) {
+        throw gftools::malformed_data("Failed to open BED file for " +
+                                      dataset + ": " + error_message());
+    }
+    unsigned char header[MAGIC_LEN];
+    struct stat result;
+    bool valid = pread(bed_fd, header, MAGIC_LEN, 0) == MAGIC_LEN;
+    for (int i = 0; valid && i < MAGIC_LEN; i++) {
+        valid = header[i] == magic_number[i];
+    }
+    if (!valid || fstat(bed_fd, &result) == -1) {
+        ::close(bed_fd);
+        throw gftools::malformed_data("Corrupt or incompatible BED file for " +
+                                      dataset);
+    }
+    off_t expected = MAGIC_LEN + (off_t) records * bytes_per_snp;
+    if (result.st_size != expected) {
+        ::close(bed_fd);
+        stringstream ss;
+        ss << "BED file for " << dataset << " holds " << result.st_size;
+        ss << " bytes, but its BIM and FAM files describe " << expected;
+        throw gftools::malformed_data(ss.str());
+    }
+    append_bed_size = result.st_size;
+    if (lseek(bed_fd, 0, SEEK_END) == -1) {
+        ::close(bed_fd);
+        throw gftools::malformed_data("Failed to open BED file for " +
+                                      dataset + ": " + error_message());
+    }
+
+    bim_fd = ::open(bim.c_str(), O_WRONLY | O_APPEND);
+    if (bim_fd == -1) {
+        ::close(bed_fd);
+        throw gftools::malformed_data("Failed to open BIM file for " +
+                                      dataset + ": " + error_message());
+    }
+
+    fd = bed_fd;
+    int bim_append_fd = bim_fd;
+    start_bed_output();
+    bim_fd = bim_append_fd;
+    bim_output = new gftools::output_stage(bim_fd, 1 << 20, 2);
+    if (unterminated) {
+        bim_output->write("\n", 1);
+    }
+    bim_stream = bim;
+    appending = true;
+    open_for_write = 1;
 }
 
 void plink_binary::open_bed_read(string filename, bool quell_mem_mapping) {
+    struct stat result;
+
+    if (stat(filename.c_str(), &result) == -1) {
+        throw gftools::malformed_data("Failed to stat BED file: " +
+                                      error_message());
+    }
+
+    flen = result.st_size;
+    fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw gftools::malformed_data("Failed to open BED file for " +
+                                      dataset + ": " + error_message());
+    }
+
+    direct_fd = -1;
+    block_pos = block_len = 0;
+
     if (quell_mem_mapping) {
+        // reads use pread on the descriptor, so need no shared file offset
         is_mem_mapped = 0;
-        bed_file = new fstream();
-        bed_file->open(filename.c_str(), std::ios::in);
-        if (!bed_file) {
-            throw gftools::malformed_data("Failed to open BED file for " +
-                                          dataset + ": " + error_message());
+#ifdef O_DIRECT
+        if (direct_io) {
+            // if the filesystem refuses, blocks are read through the cache
+            direct_fd = ::open(filename.c_str(), O_RDONLY | O_DIRECT);
         }
+#endif
     }
     else {
-        struct stat result;
-
-        if (stat(filename.c_str(), &result) == -1) {
-            throw gftools::malformed_data("Failed to stat BED file: " +
-                                          error_message());
-        }
-
-        flen = result.st_size;
-        fd = ::open(filename.c_str(), O_RDONLY);
-        if (fd == -1) {
-            throw gftools::malformed_data("Failed to open BED file for " +
-                                          dataset + ": " + error_message());
-        }
-
         fmap = (char *) mmap(0, flen, PROT_READ, MAP_PRIVATE, fd, 0);
         if (fmap == MAP_FAILED) {
+            ::close(fd);
             throw gftools::malformed_data("Failed to memory map BED file for " +
                                           dataset + ": " + error_message());
         }
@@ -462,20 +920,14 @@ void plink_binary::write_bed_header() {
         memcpy(fmap, buffer, MAGIC_LEN);
     }
     else {
-        bed_file->write(buffer, MAGIC_LEN);
+        bed_output->write(buffer, MAGIC_LEN);
     }
 }
 
 void plink_binary::read_bed_header() {
-    char buffer[MAGIC_LEN + 1];
+    unsigned char buffer[MAGIC_LEN];
 
-    if (is_mem_mapped) {
-        memcpy(buffer, fmap, MAGIC_LEN + 1);
-    }
-    else {
-        bed_file->seekg(0, std::ios_base::beg);
-        bed_file->read(buffer, MAGIC_LEN + 1);
-    }
+    extract_bed(0, MAGIC_LEN, buffer);
 
     for (int i = 0; i < MAGIC_LEN; i++) {
         if (buffer[i] != magic_number[i]) {
@@ -484,36 +936,201 @@ void plink_binary::read_bed_header() {
     }
 }
 
-void plink_binary::extract_bed(size_t pos, size_t len, char *buffer) {
+void plink_binary::extract_bed(size_t pos, size_t len, unsigned char *buffer) const {
     if (is_mem_mapped) {
-        memcpy(buffer, fmap + pos, len);
+        memcpy(buffer, mapped_bed(pos, len), len);
+        return;
+    }
+
+    // pread leaves the file offset alone, so concurrent reads are safe
+    while (len > 0) {
+        ssize_t n = pread(fd, buffer, len, pos);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw gftools::malformed_data("Failed to read BED file for " +
+                                          dataset + ": " + error_message());
+        }
+        if (n == 0) {
+            throw gftools::malformed_data("Truncated BED file for " + dataset);
+        }
+        buffer += n;
+        pos += n;
+        len -= n;
+    }
+}
+
+void plink_binary::check_snp_range(int first, int count) const {
+    if (first < 0 || count < 0 || (size_t) first + count > snp_count()) {
+        stringstream ss;
+        ss << "SNP range " << first << "+" << count;
+        ss << " is outside the " << snp_count() << " SNPs of " << dataset;
+        throw gftools::malformed_data(ss.str());
+    }
+}
+
+const unsigned char *plink_binary::mapped_bed(size_t pos, size_t len) const {
+    if (pos + len > flen) {
+        throw gftools::malformed_data("Truncated BED file for " + dataset);
+    }
+    return (const unsigned char *) fmap + pos;
+}
+
+const unsigned char *plink_binary::bed_data(int first, int count,
+                                            vector<unsigned char> &buffer) const {
+    check_snp_range(first, count);
+
+    size_t pos = MAGIC_LEN + (size_t) first * bytes_per_snp;
+    size_t len = (size_t) count * bytes_per_snp;
+
+    if (is_mem_mapped) {
+        return mapped_bed(pos, len);
+    }
+    if (len == 0) {
+        return NULL;
+    }
+
+    if (buffer.size() < len) {
+        buffer.resize(len);
+    }
+    extract_bed(pos, len, &buffer[0]);
+    return &buffer[0];
+}
+
+const unsigned char *plink_binary::snp_data(int first, int count) {
+    check_snp_range(first, count);
+
+    size_t pos = MAGIC_LEN + (size_t) first * bytes_per_snp;
+    size_t len = (size_t) count * bytes_per_snp;
+
+    if (is_mem_mapped) {
+        return mapped_bed(pos, len);
+    }
+    if (len == 0) {
+        return NULL;
+    }
+    return read_block(pos, len);
+}
+
+const unsigned char *plink_binary::read_block(size_t pos, size_t len) {
+    if (pos >= block_pos && pos + len <= block_pos + block_len) {
+        return &block_buffer[block_offset + pos - block_pos];
+    }
+
+    // Start on an aligned offset at or before pos, reading whole blocks
+    size_t start = pos - pos % READ_BLOCK_ALIGN;
+    size_t need = pos + len - start;
+    size_t want = std::max(READ_BLOCK_SIZE,
+                           need + READ_BLOCK_ALIGN - 1 -
+                           (need - 1) % READ_BLOCK_ALIGN);
+
+    block_len = 0;
+    if (block_buffer.size() < want + READ_BLOCK_ALIGN) {
+        block_buffer.resize(want + READ_BLOCK_ALIGN);
+    }
+    uintptr_t base = (uintptr_t) &block_buffer[0];
+    block_offset = (READ_BLOCK_ALIGN - base % READ_BLOCK_ALIGN) % READ_BLOCK_ALIGN;
+    unsigned char *block = &block_buffer[block_offset];
+
+    size_t got = 0;
+    while (got < want) {
+        int from = direct_fd != -1 ? direct_fd : fd;
+        ssize_t n = pread(from, block + got, want - got, start + got);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (from == direct_fd && errno == EINVAL) {
+                // e.g. an unaligned short read; carry on through the cache
+                ::close(direct_fd);
+                direct_fd = -1;
+                continue;
+            }
+            throw gftools::malformed_data("Failed to read BED file for " +
+                                          dataset + ": " + error_message());
+        }
+        if (n == 0) {
+            break;
+        }
+        got += n;
+    }
+    if (got < need) {
+        throw gftools::malformed_data("Truncated BED file for " + dataset);
+    }
+
+    block_pos = start;
+    block_len = got;
+    return block + pos - start;
+}
+
+template <typename T>
+void plink_binary::decode_snp(int snp, T *calls) const {
+    check_snp_range(snp, 1);
+
+    size_t n = individuals.size();
+    size_t pos = MAGIC_LEN + (size_t) snp * bytes_per_snp;
+
+    if (is_mem_mapped) {
+        unpack_snp(mapped_bed(pos, bytes_per_snp), calls);
+        return;
+    }
+
+    // Read through a chunk on the stack, so that no shared buffer is needed
+    const size_t chunk_len = 4096;
+    unsigned char chunk[chunk_len];
+
+    if (!subset.empty()) {
+        // A subset needs the whole SNP at once
+        vector<unsigned char> buffer;
+        unsigned char *data = chunk;
+        if (bytes_per_snp > chunk_len) {
+            buffer.resize(bytes_per_snp);
+            data = &buffer[0];
+        }
+        extract_bed(pos, bytes_per_snp, data);
+        subset.extract(data, calls);
+        return;
+    }
+
+    for (size_t i = 0; i < n; i += 4 * chunk_len) {
+        size_t len = std::min(n - i, 4 * chunk_len);
+        extract_bed(pos + i / 4, (len + 3) / 4, chunk);
+        uncompress_calls(chunk, len, calls + i);
+    }
+}
+
+template <typename T>
+void plink_binary::unpack_snp(const unsigned char *buffer, T *calls) const {
+    if (subset.empty()) {
+        uncompress_calls(buffer, individuals.size(), calls);
     }
     else {
-        bed_file->seekg(pos, std::ios_base::beg);
-        bed_file->read(buffer, len);
+        subset.extract(buffer, calls);
     }
 }
 
-void plink_binary::get_snp(size_t pos, vector<int> &genotypes) {
-    char *buffer = (char *)malloc(bytes_per_snp);
+void plink_binary::get_snp(int snp, vector<int> &genotypes) const {
+    genotypes.resize(call_count());
+    decode_snp(snp, &genotypes[0]);
+}
 
-    extract_bed(pos, bytes_per_snp, buffer);
-    genotypes.resize(0);
-    uncompress_calls(buffer, individuals.size(), genotypes);
-    free(buffer);
+void plink_binary::get_snp(int snp, vector<uint8_t> &genotypes) const {
+    genotypes.resize(call_count());
+    decode_snp(snp, &genotypes[0]);
 }
 
-void plink_binary::write_snp(snp snp, const vector<int> genotypes) {
-    if (genotypes.size() == 0) {
+void plink_binary::check_genotypes(const snp &snp, size_t count) {
+    if (count == 0) {
         throw gftools::malformed_data("No genotypes defined");
     }
     if (individuals.size() == 0) {
         throw gftools::malformed_data("No individuals defined");
     }
-    if (genotypes.size() != individuals.size()) {
+    if (count != individuals.size()) {
         stringstream ss;
         ss << "Incorrect individual count: ";
-        ss << genotypes.size();
+        ss << count;
         ss << " genotypes for SNP ";
         ss << snp.name;
         ss << " whereas ";
@@ -521,89 +1138,379 @@ void plink_binary::write_snp(snp snp, const vector<int> genotypes) {
         ss << " individuals defined.";
         throw gftools::malformed_data(ss.str());
     }
-    bed_write(snp, genotypes);
 }
 
-void plink_binary::write_snp(snp snp, vector<string> genotypes) {
-    vector<int> g_num;
-    genotypes_atoi(snp, genotypes, g_num);
-    write_snp(snp, g_num);
+void plink_binary::write_snp(const snp &snp, const vector<int> &genotypes) {
+    check_genotypes(snp, genotypes.size());
+    compress_calls(bed_write_buffer(), &genotypes[0], genotypes.size());
+    bed_write(snp);
 }
 
-void plink_binary::bed_write(snp snp, vector<int> genotypes) {
-    int len = (3 + individuals.size()) / 4;
-    char buffer[len];
-    compress_calls(buffer, genotypes);
-    snps.push_back(snp);
-    bed_file->write(buffer, len);
+void plink_binary::write_snp(const snp &snp, const vector<uint8_t> &genotypes) {
+    check_genotypes(snp, genotypes.size());
+    compress_calls(bed_write_buffer(), &genotypes[0], genotypes.size());
+    bed_write(snp);
 }
 
-// Encode/decode from plink encoding.
-// In this class we store genotypes as int: 0 (no call); 1 (AA); 2 (AB); 3 (BB)
-// Plink encodes in two bits as:            1 (no call); 0 (AA); 2 (AB); 3 (BB)
-// Note that the bytes in a bed file are written in reverse order:
-// in the plink documentation a missing genotype is binary 10;
-// 01 (as above) after reversal.
-void plink_binary::uncompress_calls(char *buffer, size_t len, vector<int> &calls) {
-    char c = buffer[0];
-    for (unsigned int i = 0; i < len; i++) {
-        if (!(i % 4)) {
-            c = buffer[i / 4];             // if div by 4 => get byte
-        }
-        char d = c & 3;
-        c >>= 2;
-        switch(d) {
-            case 1: calls.push_back(0); break;
-            case 2: calls.push_back(2); break;
-            case 3: calls.push_back(3); break;
-            case 0: calls.push_back(1); break;
-        }
+void plink_binary::write_snp(const snp &snp,
+                             const gftools::packed_genotypes &genotypes) {
+    check_genotypes(snp, genotypes.samples);
+    if (slot_fd != -1) {
+        throw gftools::malformed_data("SNPs of a presized dataset must be "
+                                      "written by write_snp_at");
     }
+    add_snp(snp);
+    bed_output->write(genotypes.data, genotypes.bytes());
 }
 
-void plink_binary::compress_calls(char *buffer, vector<int> calls) {
-    int pos = 0;
-    unsigned char c = 0;
-    for (unsigned int i = 0; i < calls.size(); i++) {
-        c >>= 2;
-        switch(calls[i]) {
-            case 1: c |= (0 << 6); break;
-            case 2: c |= (2 << 6); break;
-            case 3: c |= (3 << 6); break;
-            // treat anything else as a no call;
-            // may want to have a strict option here?
-            default: c |= (1 << 6);
+void plink_binary::copy_snps(const plink_binary &source, int first, int count) {
+    if (!open_for_write) {
+        throw gftools::malformed_data("Dataset " + dataset +
+                                      " is not open for writing");
+    }
+    if (slot_fd != -1) {
+        throw gftools::malformed_data("SNPs of a presized dataset must be "
+                                      "written by write_snp_at");
+    }
+    bool same = source.individuals.size() == individuals.size();
+    for (size_t i = 0; same && i < individuals.size(); i++) {
+        const individual &a = source.individuals[i];
+        const individual &b = individuals[i];
+        same = a.family == b.family && a.name == b.name &&
+            a.father == b.father && a.mother == b.mother &&
+            a.sex == b.sex && a.phenotype == b.phenotype;
+    }
+    if (!same) {
+        throw gftools::malformed_data("Cannot copy SNPs of " + source.dataset +
+                                      " to " + dataset + ", whose individuals "
+                                      "differ");
+    }
+    source.check_snp_range(first, count);
+
+    // Copy in runs of a few MiB, which are read into bed_buffer when the
+    // source is not memory-mapped
+    size_t bytes = (3 + individuals.size()) / 4;
+    int run = (int) std::min(std::max((size_t) 1, READ_BLOCK_SIZE / bytes),
+                             (size_t) std::max(count, 1));
+    for (int i = first; i < first + count; i += run) {
+        int n = std::min(run, first + count - i);
+        gftools::packed_snps packed = source.view_snps(i, n, bed_buffer);
+        for (int j = i; j < i + n; j++) {
+            source.snp_at(j, snp_buffer);
+            add_snp(snp_buffer);
         }
-        // write every fourth i
-        if ((i % 4) == 3) {
-            buffer[pos++] = c;
-            c = 0;
+        bed_output->write(packed.data, n * bytes);
+    }
+}
+
+void plink_binary::write_snp(const snp &snp, const vector<string> &genotypes) {
+    snp_buffer = snp;
+    call_buffer.resize(0);
+    genotypes_atoi(snp_buffer, genotypes, call_buffer);
+    write_snp(snp_buffer, call_buffer);
+}
+
+void plink_binary::presize_snps(size_t count) {
+    if (!open_for_write) {
+        throw gftools::malformed_data("Dataset " + dataset +
+                                      " is not open for writing");
+    }
+    if (slot_fd != -1 || !snps.empty() || snps_streamed > 0) {
+        throw gftools::malformed_data("SNPs have already been written to " +
+                                      dataset);
+    }
+    if (bim_output) {
+        throw gftools::malformed_data("A dataset written with stream_bim or "
+                                      "appended to cannot be presized");
+    }
+    if (individuals.empty()) {
+        throw gftools::malformed_data("No individuals defined");
+    }
+
+    // The header has been written through bed_output, which is not used again
+    bed_output->flush();
+    string filename = dataset + ".bed";
+    slot_fd = ::open(filename.c_str(), O_WRONLY);
+    if (slot_fd == -1) {
+        throw gftools::malformed_data("Failed to open BED file for " +
+                                      dataset + ": " + error_message());
+    }
+    bytes_per_snp = (3 + individuals.size()) / 4;
+    slot_lock = new pthread_mutex_t;
+    pthread_mutex_init(slot_lock, NULL);
+    allocate_slots(std::max(count, (size_t) 1));
+    snps.reserve(count);
+    slot_written.reserve(count);
+}
+
+// Extends the BED file to a number of SNP slots, reserving its blocks where
+// the filesystem supports it
+void plink_binary::allocate_slots(size_t count) {
+    off_t size = MAGIC_LEN + (off_t) count * bytes_per_snp;
+    if (posix_fallocate(slot_fd, 0, size) != 0 &&
+        ftruncate(slot_fd, size) == -1) {
+        throw gftools::malformed_data("Failed to size BED file for " +
+                                      dataset + ": " + error_message());
+    }
+    slot_capacity = count;
+}
+
+void plink_binary::write_snp_at(size_t index, const snp &snp,
+                                const gftools::packed_genotypes &genotypes) {
+    if (slot_fd == -1) {
+        throw gftools::malformed_data("BED file for " + dataset +
+                                      " has not been presized");
+    }
+    check_genotypes(snp, genotypes.samples);
+
+    bool taken;
+    pthread_mutex_lock(slot_lock);
+    try {
+        taken = index < slot_written.size() && slot_written[index];
+        if (!taken) {
+            if (index >= slot_capacity) {
+                allocate_slots(std::max(index + 1, 2 * slot_capacity));
+            }
+            if (index >= slot_written.size()) {
+                slot_written.resize(index + 1, false);
+                snps.resize(index + 1);
+            }
+            snps[index] = snp;
+            slot_written[index] = true;
+            slots_written++;
         }
     }
-    // if not a multiple of four, need to right shift stored data
-    // to low end of byte
-    if (calls.size() % 4) {
-        int unfilled = calls.size();
-        while (unfilled++ % 4) {
-            c >>= 2;
+    catch (...) {
+        pthread_mutex_unlock(slot_lock);
+        throw;
+    }
+    pthread_mutex_unlock(slot_lock);
+
+    if (taken) {
+        stringstream ss;
+        ss << "SNP slot " << index << " of " << dataset;
+        ss << " has already been written";
+        throw gftools::malformed_data(ss.str());
+    }
+
+    const char *data = (const char *) genotypes.data;
+    size_t len = genotypes.bytes();
+    off_t pos = MAGIC_LEN + (off_t) index * bytes_per_snp;
+    while (len > 0) {
+        ssize_t n = pwrite(slot_fd, data, len, pos);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw gftools::malformed_data("Failed to write BED file for " +
+                                          dataset + ": " + error_message());
         }
-        buffer[pos] = c;
+        data += n;
+        len -= n;
+        pos += n;
+    }
+}
+
+void plink_binary::write_snp_at(size_t index, const snp &snp,
+                                const vector<uint8_t> &genotypes) {
+    if (slot_fd == -1) {
+        throw gftools::malformed_data("BED file for " + dataset +
+                                      " has not been presized");
+    }
+    check_genotypes(snp, genotypes.size());
+
+    // Pack into a pooled buffer, so that once each writing thread has had
+    // one, packing allocates nothing
+    vector<unsigned char> packed;
+    pthread_mutex_lock(slot_lock);
+    if (!pack_buffers.empty()) {
+        packed.swap(pack_buffers.back());
+        pack_buffers.pop_back();
+    }
+    pthread_mutex_unlock(slot_lock);
+
+    packed.resize((genotypes.size() + 3) / 4);
+    compress_calls(&packed[0], &genotypes[0], genotypes.size());
+    try {
+        write_snp_at(index, snp,
+                     gftools::packed_genotypes(&packed[0], genotypes.size()));
+    }
+    catch (...) {
+        release_pack_buffer(packed);
+        throw;
     }
+    release_pack_buffer(packed);
+}
 
+// Returns a buffer used by write_snp_at to the pool
+void plink_binary::release_pack_buffer(vector<unsigned char> &packed) {
+    pthread_mutex_lock(slot_lock);
+    try {
+        pack_buffers.push_back(vector<unsigned char>());
+        pack_buffers.back().swap(packed);
+    }
+    catch (...) {
+        // the buffer is freed instead
+    }
+    pthread_mutex_unlock(slot_lock);
 }
 
-string plink_binary::call_str(const vector<string> &g_str) {
-    std::stringstream ss;
-    ss << "[";
+// Checks that every slot of a presized BED file was written and cuts the
+// file to the slots used
+void plink_binary::close_slots() {
+    if (slot_fd == -1) {
+        return;
+    }
 
-    vector<string>::const_iterator gi;
-    for (gi = g_str.begin(); gi < g_str.end(); gi++) {
-        if (gi != g_str.begin()) {
-            ss << ", ";
-        }
-        ss << *gi;
+    size_t count = slot_written.size();
+    size_t missing = count;
+    if (slots_written != count) {
+        missing = std::find(slot_written.begin(), slot_written.end(), false) -
+            slot_written.begin();
     }
-    ss << "]";
+    bool cut = ftruncate(slot_fd, MAGIC_LEN + (off_t) count * bytes_per_snp) == 0;
+    string error = cut ? "" : error_message();
+
+    ::close(slot_fd);
+    slot_fd = -1;
+    pthread_mutex_destroy(slot_lock);
+    delete slot_lock;
+    slot_lock = NULL;
+    vector<vector<unsigned char> >().swap(pack_buffers);
+
+    if (missing < count) {
+        stringstream ss;
+        ss << "SNP slot " << missing << " of " << dataset;
+        ss << " was not written";
+        throw gftools::malformed_data(ss.str());
+    }
+    if (!cut) {
+        throw gftools::malformed_data("Failed to size BED file for " +
+                                      dataset + ": " + error);
+    }
+}
+
+void plink_binary::open_bim_stream() {
+    bim_stream = dataset + ".bim.tmp";
+    bim_fd = ::open(bim_stream.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (bim_fd == -1) {
+        bim_stream.clear();
+        throw gftools::malformed_data("Failed to open BIM file for " +
+                                      dataset + ": " + error_message());
+    }
+    bim_output = new gftools::output_stage(bim_fd, 1 << 20, 2);
+}
+
+// Writes out and stops bim_output and closes the temporary BIM file,
+// returning any error
+string plink_binary::close_bim_stream() {
+    if (!bim_output) {
+        return "";
+    }
+
+    string error;
+    try {
+        bim_output->close();
+    }
+    catch (std::exception &e) {
+        error = e.what();
+    }
+    delete bim_output;
+    bim_output = NULL;
+
+    if (::close(bim_fd) == -1 && error.empty()) {
+        error = "Failed to close BIM file for " + dataset + ": " +
+            error_message();
+    }
+    bim_fd = -1;
+    return error;
+}
+
+// Records a SNP written to the BED file
+void plink_binary::add_snp(const snp &snp) {
+    if (!bim_output) {
+        snps.push_back(snp);
+        return;
+    }
+    bim_record.clear();
+    append_bim(snp, bim_record);
+    bim_record += '\n';
+    bim_output->write(bim_record.data(), bim_record.size());
+    snps_streamed++;
+}
+
+// Returns space for the packed calls of a SNP, preferably in place in
+// bed_output
+unsigned char *plink_binary::bed_write_buffer() {
+    size_t len = (3 + individuals.size()) / 4;
+    unsigned char *buffer = bed_output->claim(len);
+    bed_claimed = buffer != NULL;
+    if (buffer) {
+        return buffer;
+    }
+    if (bed_buffer.size() < len) {
+        bed_buffer.resize(len);
+    }
+    return &bed_buffer[0];
+}
+
+void plink_binary::bed_write(const snp &snp) {
+    if (slot_fd != -1) {
+        throw gftools::malformed_data("SNPs of a presized dataset must be "
+                                      "written by write_snp_at");
+    }
+    add_snp(snp);
+    size_t len = (3 + individuals.size()) / 4;
+    if (bed_claimed) {
+        bed_output->commit(len);
+    }
+    else {
+        bed_output->write(&bed_buffer[0], len);
+    }
+}
+
+// Writes out and stops bed_output and closes the BED file, returning any
+// error rather than throwing, so that the caller can finish closing
+string plink_binary::close_bed_output() {
+    string error;
+    try {
+        bed_output->close();
+    }
+    catch (std::exception &e) {
+        error = e.what();
+    }
+    delete bed_output;
+    bed_output = NULL;
+
+    if (::close(fd) == -1 && error.empty()) {
+        error = "Failed to close BED file for " + dataset + ": " +
+            error_message();
+    }
+    fd = -1;
+    return error;
+}
+
+// Encode/decode from plink encoding.
+// In this class we store genotypes as int or uint8_t:
+//                                          0 (no call); 1 (AA); 2 (AB); 3 (BB)
+// Plink encodes in two bits as:            1 (no call); 0 (AA); 2 (AB); 3 (BB)
+// Note that the bytes in a bed file are written in reverse order:
+// in the plink documentation a missing genotype is binary 10;
+// 01 (as above) after reversal.
+void plink_binary::uncompress_calls(const unsigned char *buffer, size_t len, int *calls) const {
+    gftools::unpack_calls(buffer, len, calls);
+}
+
+void plink_binary::uncompress_calls(const unsigned char *buffer, size_t len, uint8_t *calls) const {
+    gftools::unpack_calls(buffer, len, calls);
+}
+
+void plink_binary::compress_calls(unsigned char *buffer, const int *calls, size_t len) {
+    // anything other than 1..3 is treated as a no call;
+    // may want to have a strict option here?
+    gftools::pack_calls(calls, len, buffer);
+}
 
-    return ss.str();
+void plink_binary::compress_calls(unsigned char *buffer, const uint8_t *calls, size_t len) {
+    gftools::pack_calls(calls, len, buffer);
 }
@@ -24,16 +24,34 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <stdint.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <pthread.h>
 #include "snp.h"
+#include "chromosome.h"
 #include "individual.h"
 #include "exceptions.h"
+#include "name_index.h"
+#include "output_stage.h"
+#include "packed_genotypes.h"
+#include "region_index.h"
+#include "sample_subset.h"
+#include "snp_table.h"
 
 class plink_binary {
 private:
     bool open_for_write;
-    std::fstream *bed_file;
+    gftools::output_stage *bed_output; // buffers BED data for writing
+    std::string bim_stream;    // BIM file written as SNPs are, or empty
+    bool appending;            // SNPs are appended to an existing dataset
+    off_t append_bed_size;     // sizes of the files before appending
+    off_t append_bim_size;
+    int bim_fd;
+    gftools::output_stage *bim_output; // buffers BIM records of bim_tmp
+    size_t snps_streamed;      // SNPs written to bim_tmp
+    std::string bim_record;    // reused by add_snp
+    bool bed_claimed;          // bed_write_buffer returned space in bed_output
 
     // for BED file
     bool is_mem_mapped;
@@ -42,30 +60,94 @@ private:
     int fd;
     unsigned int snp_ptr;      // index to next snp to be read
     unsigned int bytes_per_snp;
+    std::vector<unsigned char> bed_buffer; // holds BED data for writing
+    int slot_fd;               // descriptor for writes to SNP slots, or -1
+    size_t slot_capacity;      // SNP slots allocated in the BED file
+    size_t slots_written;
+    std::vector<bool> slot_written;
+    pthread_mutex_t *slot_lock; // guards snps and the slots when presized
+    std::vector<std::vector<unsigned char> > pack_buffers; // free buffers for
+                               // packing slots, guarded by slot_lock
+    int direct_fd;             // O_DIRECT descriptor for block reads, or -1
+    std::vector<unsigned char> block_buffer; // holds a block of BED data when not memory-mapped
+    size_t block_offset;       // start of the block within block_buffer
+    size_t block_pos;          // file offset of the block
+    size_t block_len;          // bytes of BED data in the block
+    std::vector<uint8_t> call_buffer; // reused by next_snp and write_snp
+    gftools::snp snp_buffer;      // reused by write_snp and read_snp
+    gftools::sample_subset subset; // individuals returned by decoding reads
+    gftools::region_index regions; // loaded from the sidecar, or built on first use
+    std::vector<std::vector<gftools::snp_range> > chromosome_runs; // SNPs by chromosome code
 
     void read_bed_header();
 
     void write_bed_header();
 
-    void bed_write(gftools::snp snp, std::vector<int> genotypes);
+    void bed_write(const gftools::snp &snp);
 
-    void uncompress_calls(char *buffer, size_t len, std::vector<int> &genotypes);
+    void allocate_slots(size_t count);
 
-    void compress_calls(char *buffer, std::vector<int> genotypes);
+    void close_slots();
+
+    void release_pack_buffer(std::vector<unsigned char> &packed);
+
+    bool restore_appended(const std::string &bim_file);
+
+    void close_new_dataset(const std::string &error,
+                           const std::string &bim_file);
+
+    void start_bed_output();
+
+    std::string close_bed_output();
+
+    void open_bim_stream();
+
+    std::string close_bim_stream();
+
+    void add_snp(const gftools::snp &snp);
+
+    unsigned char *bed_write_buffer();
+
+    void check_genotypes(const gftools::snp &snp, size_t count);
+
+    void uncompress_calls(const unsigned char *buffer, size_t len, int *calls) const;
+
+    void uncompress_calls(const unsigned char *buffer, size_t len, uint8_t *calls) const;
+
+    void compress_calls(unsigned char *buffer, const int *calls, size_t len);
+
+    void compress_calls(unsigned char *buffer, const uint8_t *calls, size_t len);
 
     void open_bed_write(std::string filename);
 
     void open_bed_read(std::string filename, bool quell_mem_mapping);
 
-    void get_snp(size_t pos, std::vector<int> &genotypes);
+    void get_snp(int snp, std::vector<int> &genotypes) const;
+
+    void get_snp(int snp, std::vector<uint8_t> &genotypes) const;
+
+    template <typename T> void decode_snp(int snp, T *calls) const;
+
+    template <typename T> void unpack_snp(const unsigned char *buffer, T *calls) const;
 
-    void extract_bed(size_t pos, size_t len, char *buffer);
+    void extract_bed(size_t pos, size_t len, unsigned char *buffer) const;
+
+    void check_snp_range(int first, int count) const;
+
+    const unsigned char *mapped_bed(size_t pos, size_t len) const;
+
+    const unsigned char *bed_data(int first, int count,
+                                  std::vector<unsigned char> &buffer) const;
+
+    const unsigned char *snp_data(int first, int count);
+
+    const unsigned char *read_block(size_t pos, size_t len);
 
     void init(std::string dataset, bool mode);
 
-    bool is_empty(std::ifstream &ifstream);
+    void index_chromosomes();
 
-    std::string call_str(const std::vector<std::string> &calls);
+    bool is_empty(std::ifstream &ifstream);
 
 public:
     /// The dataset name.
@@ -74,12 +156,37 @@ public:
     char missing_genotype;
     /// Prevent memory-mapping of the BED file, if true.
     bool quell_mem_mapping;
+    /// Bypass the page cache with O_DIRECT when reading the BED file in
+    /// blocks, if true and memory-mapping is quelled. Ignored where the
+    /// filesystem does not support it.
+    bool direct_io;
+    /// Load the SNPs, individuals and region index from the binary sidecar
+    /// file dataset.gfidx when it is current, and write it when it is not,
+    /// if true. With compact_snps, the SNPs are loaded a column at a time;
+    /// without, each is still copied into snps.
+    bool use_sidecar;
+    /// Keep the SNPs read from the BIM file in the compact snp_columns
+    /// table rather than in snps, if true. snp_count and snp_at read SNPs
+    /// in either case.
+    bool compact_snps;
+    /// Write each SNP to the BIM file as it is written to the BED file,
+    /// rather than keeping the SNPs in snps until close, if true when
+    /// opening for writing. The records go to dataset.bim.tmp, which close
+    /// renames to dataset.bim. SNPs cannot then be written by write_snp_at.
+    bool stream_bim;
     /// The vector of SNPs.
     std::vector<gftools::snp> snps;
+    /// The SNPs, when compact_snps was set on opening for reading.
+    gftools::snp_table snp_columns;
     /// The vector of individuals.
     std::vector<gftools::individual> individuals;
     /// An index of SNPs by name, mapping the name to an index in the BED data.
-    std::map<std::string, int> snp_index;
+    /// Empty when compact_snps was set, as snp_columns then indexes the
+    /// names without storing them again; find_snp looks names up in either.
+    gftools::name_index snp_index;
+    /// The chromosome code of each SNP in the BED data, as given by
+    /// gftools::chromosome_code, set on opening for reading.
+    std::vector<uint8_t> chromosome_codes;
 
     /** Constructor that creates and initializes named dataset.
      * Implicitly opens the dataset in read mode.
@@ -93,7 +200,8 @@ public:
      */
     plink_binary();
 
-    /** The destructor.
+    /** The destructor. A dataset still open for writing is abandoned, as
+     * by abort.
      */
     ~plink_binary();
 
@@ -110,10 +218,32 @@ public:
      */
     void open(std::string dataset);
 
+    /** Opens an existing Plink dataset to append SNPs to it.
+     *
+     * The FAM file is read into individuals, and the BED file is checked
+     * to be a SNP-major file holding exactly the SNPs of the BIM file.
+     * SNPs written by write_snp are then appended to the BED and BIM
+     * files; the FAM file is left as it is. If close fails, or the dataset
+     * is abandoned by abort or destroyed without being closed, the BED and
+     * BIM files are cut back to their original lengths.
+     *
+     * @param dataset The dataset name.
+     */
+    void open_append(std::string dataset);
+
     /** Closes an initialized Plink dataset.
      */
     void close(void);
 
+    /** Abandons a dataset open for writing, e.g. after an error part way
+     * through writing it, stopping its output without writing the FAM or
+     * BIM file. A dataset opened by open_append is restored to its original
+     * state, with the BED and BIM files cut back to their original lengths;
+     * a new dataset is left without FAM or BIM files. Does nothing if the
+     * dataset is not open for writing.
+     */
+    void abort();
+
     /** Populates a SNP vector with SNP data from a Plink BIM format file.
      *
      * The BIM file name is calculated from the current dataset name. This
@@ -130,7 +260,7 @@ public:
      *
      * @param snps A reference to a vector of SNPs.
      */
-    void write_bim(std::vector<gftools::snp> snps);
+    void write_bim(const std::vector<gftools::snp> &snps);
 
     /** Makes a SNP from a Plink BIM format record.
      *
@@ -144,7 +274,7 @@ public:
      * @param snp A SNP.
      * @return A BIM record.
      */
-    std::string to_bim(gftools::snp snp);
+    std::string to_bim(const gftools::snp &snp);
 
     /** Populates a vector with individual data from a Plink FAM format file.
      *
@@ -162,7 +292,7 @@ public:
      *
      * @param ind A reference to an individual.
      */
-    void write_fam(std::vector<gftools::individual> ind);
+    void write_fam(const std::vector<gftools::individual> &ind);
 
     /** Makes an individual from a Plink FAM record.
      *
@@ -176,7 +306,45 @@ public:
      * @param ind An individual.
      * @return A FAM record.
      */
-    std::string to_fam(gftools::individual ind);
+    std::string to_fam(const gftools::individual &ind);
+
+    /** Returns the number of SNPs, whether held in snps or snp_columns, or
+     * the number written so far by a dataset open for writing with
+     * stream_bim or for appending.
+     */
+    size_t snp_count() const;
+
+    /** Finds a SNP by name, whether held in snps or snp_columns.
+     *
+     * @param name The SNP name.
+     * @return The index of the SNP in the BED data, or -1 if there is no
+     * SNP of that name. Where names repeat, the last SNP is found.
+     */
+    int find_snp(const std::string &name) const;
+
+    /** Copies a SNP, whether held in snps or snp_columns.
+     *
+     * @param snp_index The index of the SNP in the BED data.
+     * @param snp A SNP, overwritten.
+     */
+    void snp_at(int snp_index, gftools::snp &snp) const;
+
+    /** Returns the class flags of a SNP, given by its chromosome code.
+     *
+     * @param snp_index The index of the SNP in the BED data.
+     * @return One of gftools::AUTOSOMAL, X_LINKED, Y_LINKED,
+     * PSEUDOAUTOSOMAL, MITOCHONDRIAL or UNPLACED.
+     */
+    unsigned int snp_class(int snp_index) const;
+
+    /** Returns the SNPs on a chromosome, as runs of consecutive SNPs in
+     * the BED data that may be passed to view_snps or read_snps. A BIM
+     * file sorted by chromosome gives at most one run per chromosome.
+     *
+     * @param code A chromosome code, 0 for unplaced SNPs.
+     * @return The runs of SNPs, empty if there are none.
+     */
+    const std::vector<gftools::snp_range> &chromosome_ranges(int code) const;
 
     /** Decodes the next SNP and its genotype calls from BED data.
      *
@@ -187,8 +355,23 @@ public:
      */
     bool next_snp(gftools::snp &snp, std::vector<std::string> &genotypes);
 
+    /** Decodes the next SNP and its genotype call integer codes from BED data.
+     *
+     * @param snp A SNP reference that will be pointed to the next SNP.
+     * @param genotypes A vector of genotype call codes for the SNP.
+     * @return true if there are further SNPs.
+     */
+    bool next_snp(gftools::snp &snp, std::vector<int> &genotypes);
+
+    /** Decodes the next SNP and its genotype call codes from BED data, one
+     * byte per call.
+     *
+     * @see next_snp(gftools::snp &snp, std::vector<int> &genotypes)
+     */
+    bool next_snp(gftools::snp &snp, std::vector<uint8_t> &genotypes);
+
     /** Looks up a SNP by name and updates a vector of genotype strings to the
-     * calls for that SNP.
+     * calls for that SNP. Throws malformed_data if there is no such SNP.
      *
      * @param snp A SNP name.
      * @param genotypes A vector of genotype call strings.
@@ -198,10 +381,212 @@ public:
     /** Looks up a SNP by index in the BED data and updates a vector of genotype
      * call integer codes for that SNP.
      *
+     * Reads by index do not change the position of next_snp and may be
+     * made concurrently from several threads sharing one open dataset.
+     *
      * @param snp A SNP index.
      * @param genotypes A vector of genotype call codes.
      */
-    void read_snp(int snp, std::vector<int> &genotypes);
+    void read_snp(int snp, std::vector<int> &genotypes) const;
+
+    /** Looks up a SNP by index in the BED data and updates a vector of genotype
+     * call codes for that SNP, one byte per call.
+     *
+     * @see read_snp(int snp, std::vector<int> &genotypes)
+     */
+    void read_snp(int snp, std::vector<uint8_t> &genotypes) const;
+
+    /** Looks up a SNP by index in the BED data and returns a view of its
+     * packed genotype calls, without decoding them.
+     *
+     * When the BED file is memory-mapped, the view points directly into the
+     * map and remains valid until the dataset is closed. Otherwise it points
+     * into a buffer owned by this instance and is only valid until the next
+     * read.
+     *
+     * @param snp A SNP index.
+     * @return A view of the packed calls for that SNP.
+     */
+    gftools::packed_genotypes view_snp(int snp);
+
+    /** Looks up a SNP by index in the BED data and returns a view of its
+     * packed genotype calls, without decoding them.
+     *
+     * Unlike view_snp(int snp), this may be called concurrently from several
+     * threads sharing one open dataset. When the BED file is not
+     * memory-mapped, the view points into the supplied buffer.
+     *
+     * @param snp A SNP index.
+     * @param buffer A buffer to hold the packed calls if required, resized
+     * as necessary.
+     * @return A view of the packed calls for that SNP.
+     */
+    gftools::packed_genotypes view_snp(int snp,
+                                       std::vector<unsigned char> &buffer) const;
+
+    /** Returns a view of the packed genotype calls of a run of consecutive
+     * SNPs in the BED data, without decoding them.
+     *
+     * @see view_snp(int snp)
+     *
+     * @param first The index of the first SNP.
+     * @param count The number of SNPs.
+     * @return A view of the packed calls for those SNPs.
+     */
+    gftools::packed_snps view_snps(int first, int count);
+
+    /** Returns a view of the packed genotype calls of a run of consecutive
+     * SNPs in the BED data, without decoding them.
+     *
+     * @see view_snp(int snp, std::vector<unsigned char> &buffer)
+     *
+     * @param first The index of the first SNP.
+     * @param count The number of SNPs.
+     * @param buffer A buffer to hold the packed calls if required, resized
+     * as necessary.
+     * @return A view of the packed calls for those SNPs.
+     */
+    gftools::packed_snps view_snps(int first, int count,
+                                   std::vector<unsigned char> &buffer) const;
+
+    /** Decodes a run of consecutive SNPs in the BED data into a matrix of
+     * genotype call codes, one byte per call.
+     *
+     * In SNP-major order, the calls of each SNP are contiguous, i.e. the
+     * call of individual i for the j-th SNP of the run is at
+     * j * call_count() + i. In sample-major order, the calls of each
+     * individual are contiguous, i.e. that call is at i * count + j.
+     *
+     * Like read_snp(int snp, std::vector<int> &genotypes), this may be
+     * called concurrently from several threads sharing one open dataset.
+     *
+     * @param first The index of the first SNP.
+     * @param count The number of SNPs.
+     * @param matrix A vector of genotype call codes, resized to hold
+     * count * call_count() calls.
+     * @param sample_major If true, the matrix is in sample-major order,
+     * otherwise SNP-major.
+     */
+    void read_snps(int first, int count, std::vector<uint8_t> &matrix,
+                   bool sample_major = false) const;
+
+    /** Decodes a run of consecutive SNPs in the BED data into a matrix of
+     * genotype call codes, one byte per call.
+     *
+     * @see read_snps(int first, int count, std::vector<uint8_t> &matrix,
+     * bool sample_major)
+     *
+     * @param first The index of the first SNP.
+     * @param count The number of SNPs.
+     * @param matrix An array of at least count * call_count() genotype
+     * call codes, overwritten.
+     * @param sample_major If true, the matrix is in sample-major order,
+     * otherwise SNP-major.
+     */
+    void read_snps(int first, int count, uint8_t *matrix,
+                   bool sample_major = false) const;
+
+    /** Finds the SNPs on a chromosome with physical positions in a closed
+     * interval, as runs of consecutive SNPs in the BED data that may be
+     * passed to view_snps or read_snps.
+     *
+     * The SNPs are indexed by position on the first call, and the index is
+     * kept until the dataset is closed. Build a gftools::region_index
+     * directly to share one between threads.
+     *
+     * @param chromosome The chromosome name, matched as by
+     * gftools::region_index.
+     * @param start The first position of the region.
+     * @param end The last position of the region.
+     * @param ranges A vector of runs of SNPs, overwritten.
+     */
+    void find_region(const std::string &chromosome, int start, int end,
+                     std::vector<gftools::snp_range> &ranges);
+
+    /** Advises the kernel that a run of consecutive SNPs in the BED data
+     * will be read soon, so that it may start reading them in ahead. This
+     * is only a hint; failures are ignored.
+     *
+     * @param first The index of the first SNP.
+     * @param count The number of SNPs.
+     */
+    void prefetch_snps(int first, int count) const;
+
+    /** Restricts the calls returned by the decoding reads (next_snp,
+     * read_snp and read_snps) to a subset of the individuals, in the given
+     * order. Views of packed calls are not affected.
+     *
+     * The selection applies until the dataset is closed, or until it is
+     * replaced or cleared by keep_all_samples. An empty selection is
+     * refused with malformed_data, leaving the current one in place; call
+     * keep_all_samples to return to all individuals.
+     *
+     * @param indices The indices of the individuals to keep.
+     */
+    void keep_samples(const std::vector<int> &indices);
+
+    /** Restricts the calls returned by the decoding reads to a subset of
+     * the individuals, selected by name.
+     *
+     * @see keep_samples(const std::vector<int> &indices)
+     *
+     * @param names The names of the individuals to keep.
+     */
+    void keep_samples(const std::vector<std::string> &names);
+
+    /** Returns the decoding reads to the calls of all individuals.
+     */
+    void keep_all_samples();
+
+    /** Returns the number of calls per SNP returned by the decoding reads:
+     * the number of kept individuals, or of all individuals if no subset
+     * has been selected.
+     */
+    size_t call_count() const;
+
+    /** Decodes a view of the packed calls of one SNP into genotype call
+     * codes, keeping only the selected individuals, as the decoding reads
+     * do.
+     *
+     * @param packed A view returned by view_snp or view_snps.
+     * @param calls An array of at least call_count() genotype call codes,
+     * overwritten.
+     */
+    void decode_calls(const gftools::packed_genotypes &packed,
+                      uint8_t *calls) const;
+
+    /** Sizes the BED data of a dataset open for writing for a number of
+     * SNPs, after which SNPs are written by write_snp_at into fixed slots,
+     * possibly from several threads at once, instead of by write_snp.
+     *
+     * The count may be an estimate: writing past it grows the file, and on
+     * closing the file is cut to the highest slot written. Every slot up to
+     * that one must have been written, or close throws malformed_data. Call
+     * this before writing any SNP, once the individuals are set.
+     *
+     * @param count The expected number of SNPs.
+     */
+    void presize_snps(size_t count);
+
+    /** Writes a SNP and its packed genotypes into a slot of a dataset
+     * presized by presize_snps, with pwrite. Slots may be written in any
+     * order and by several threads concurrently, each slot once.
+     *
+     * @param index The index of the SNP in the BED data.
+     * @param snp A snp whose data will be written.
+     * @param genotypes A view of packed genotype calls.
+     */
+    void write_snp_at(size_t index, const gftools::snp &snp,
+                      const gftools::packed_genotypes &genotypes);
+
+    /** Writes a SNP and its genotype call codes into a slot of a dataset
+     * presized by presize_snps, packing them on the calling thread.
+     *
+     * @see write_snp_at(size_t index, const gftools::snp &snp,
+     * const gftools::packed_genotypes &genotypes)
+     */
+    void write_snp_at(size_t index, const gftools::snp &snp,
+                      const std::vector<uint8_t> &genotypes);
 
     /** Writes the data of a SNP and its corresponding genotypes into the BED data.
      *
@@ -213,16 +598,45 @@ public:
      * @param snp A snp whose data will be written.
      * @param genotypes A vector of genotype call integer codes.
      */
-    void write_snp(const gftools::snp snp, const std::vector<int> genotypes);
+    void write_snp(const gftools::snp &snp, const std::vector<int> &genotypes);
+
+    /** Writes the data of a SNP and its corresponding genotypes into the BED
+     * data, from genotype call codes of one byte per call.
+     *
+     * @see write_snp(const gftools::snp &snp, const std::vector<int> &genotypes)
+     */
+    void write_snp(const gftools::snp &snp, const std::vector<uint8_t> &genotypes);
+
+    /** Copies a run of consecutive SNPs of another dataset and their packed
+     * genotype calls to the end of this dataset, open for writing or for
+     * appending, without decoding them. Both datasets must have the same
+     * individuals, in the same order.
+     *
+     * @param source A dataset open for reading.
+     * @param first The index of the first SNP in the source.
+     * @param count The number of SNPs.
+     */
+    void copy_snps(const plink_binary &source, int first, int count);
+
+    /** Writes the data of a SNP and its genotypes, already packed as in the
+     * BED data, e.g. by gftools::pack_calls or in a view of another dataset.
+     *
+     * @see write_snp(const gftools::snp &snp, const std::vector<int> &genotypes)
+     *
+     * @param snp A snp whose data will be written.
+     * @param genotypes A view of packed genotype calls.
+     */
+    void write_snp(const gftools::snp &snp,
+                   const gftools::packed_genotypes &genotypes);
 
     /** Writes the data of a SNP and its corresponding genotypes into the BED data.
      *
-     * @see write_snp(gftools::snp snp, std::vector<int> genotypes)
+     * @see write_snp(const gftools::snp &snp, const std::vector<int> &genotypes)
      *
      * @param snp A snp whose data will be written.
      * @param genotypes A vector of genotype call strings.
      */
-    void write_snp(gftools::snp snp, std::vector<std::string> genotypes);
+    void write_snp(const gftools::snp &snp, const std::vector<std::string> &genotypes);
 
     /** Translates integer representations of genotype calls for one SNP to their
      * corresponding string representations.
@@ -235,16 +649,25 @@ public:
      * @param g_str A vector of genotype call strings, updated according to
      * the integer codes.
      */
-    void genotypes_itoa(gftools::snp snp, const std::vector<int> g_num, std::vector<std::string> &g_str);
+    void genotypes_itoa(const gftools::snp &snp, const std::vector<int> &g_num, std::vector<std::string> &g_str) const;
+
+    /** Translates genotype call codes of one byte per call for one SNP to
+     * their corresponding string representations.
+     *
+     * @see genotypes_itoa(const gftools::snp &snp, const std::vector<int> &g_num,
+     * std::vector<std::string> &g_str)
+     */
+    void genotypes_itoa(const gftools::snp &snp, const std::vector<uint8_t> &g_num, std::vector<std::string> &g_str) const;
 
     /** Translates string representations of genotype calls for one SNP to their
      * corresponding integer representations and updates the alleles of the SNP.
      *
-     * The character '0' is reserved to mean no-call in the string
+     * The missing_genotype character is reserved to mean no-call in the string
      * representation, otherwise the character used to represent each allele is
-     * unimportant. However, if more than two alleles are called, an error will
-     * be raised. If either called allele is in disagreement with the expected
-     * alleles of the SNP, and error will be raised.
+     * unimportant. If the SNP has no alleles, they are collated from the calls
+     * in order of first appearance and set on the SNP; if more than two alleles
+     * are called, an error will be raised. If either called allele is in
+     * disagreement with the expected alleles of the SNP, an error will be raised.
      *
      * The integer codes created for each genotype are:
      *
@@ -259,12 +682,22 @@ public:
      * @param g_num A vector of genotype call strings for the SNP, each allele
      * being a single character.
      */
-    void genotypes_atoi(gftools::snp &snp, const std::vector<std::string> g_str, std::vector<int> &g_num);
+    void genotypes_atoi(gftools::snp &snp, const std::vector<std::string> &g_str, std::vector<int> &g_num);
+
+    /** Translates string representations of genotype calls for one SNP to
+     * genotype call codes of one byte per call.
+     *
+     * @see genotypes_atoi(gftools::snp &snp, const std::vector<std::string> &g_str,
+     * std::vector<int> &g_num)
+     */
+    void genotypes_atoi(gftools::snp &snp, const std::vector<std::string> &g_str, std::vector<uint8_t> &g_num);
 
     /** Collates genotype call strings to determine the alleles involved.
      *
-     * Splits each call string to determine the alleles involved. Checks the
-     * number of alleles involved.
+     * The alleles are those genotypes_atoi gives a SNP without alleles:
+     * in order of first appearance, with "0" for an allele never called.
+     * Throws malformed_data if there are more than two alleles, or if a
+     * call is not two characters or has only one allele missing.
      * @param g_str A vector of genotype call strings.
      * @return A pair of allele strings, A and B.
      */
@@ -2,20 +2,33 @@
 
 %include "std_vector.i"
 %include "std_string.i"
+%include "stdint.i"
 
 %{
 #include "individual.h"
 #include "snp.h"
+#include "chromosome.h"
+#include "name_index.h"
+#include "packed_genotypes.h"
+#include "snp_table.h"
+#include "region_index.h"
 #include "plink_binary.h"
 %}
 
 %include "individual.h"
 %include "snp.h"
+%include "chromosome.h"
+%include "name_index.h"
+%include "packed_genotypes.h"
+%include "snp_table.h"
+%include "region_index.h"
 %include "plink_binary.h"
 
 namespace std {
     %template(vectorstr) std::vector<string>;
     %template(vectori) std::vector<int>;
+    %template(vectoru8) std::vector<uint8_t>;
     %template(vectorind) std::vector<gftools::individual>;
     %template(vectorsnp) std::vector<gftools::snp>;
+    %template(vectorrange) std::vector<gftools::snp_range>;
 }
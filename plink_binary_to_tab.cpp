@@ -1,4 +1,6 @@
 #include "plink_binary.h"
+#include "snp_prefetcher.h"
+#include "genotype_formatter.h"
 #include <iostream>
 
 /*
@@ -14,6 +16,9 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    // Genotypes are written in whole lines, so stdio buffering is not needed
+    ios::sync_with_stdio(false);
+
     plink_binary *pb;
     try {
         pb = new plink_binary(argv[1]);
@@ -27,12 +32,18 @@ int main(int argc, char *argv[])
         cout << "\t" << pb->individuals[i].name;
     cout << endl;
 
-    vector<string> genotypes;
+    vector<uint8_t> genotypes;
     gftools::snp snp;
-    while (pb->next_snp(snp, genotypes)) {
-        cout << snp.name;
-        for (unsigned int i = 0; i < genotypes.size(); i++)
-            cout << "\t" << genotypes[i];
-        cout << endl;
+    gftools::genotype_formatter formatter("\t", "", pb->missing_genotype);
+    vector<char> line;
+
+    // Read and decode ahead while formatting
+    gftools::snp_prefetcher reader(*pb);
+    while (reader.next_snp(snp, genotypes)) {
+        line.assign(snp.name.begin(), snp.name.end());
+        formatter.set_snp(snp);
+        formatter.append(genotypes, line);
+        line.push_back('\n');
+        cout.write(&line[0], line.size());
     }
 }
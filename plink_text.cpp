@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utilities.h"
+#include "plink_text.h"
+
+using std::string;
+using std::vector;
+
+// Files smaller than this are parsed on the calling thread
+const size_t PARALLEL_PARSE_BYTES = 8 << 20;
+
+static inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Finds the next field of a record, returning false if there is none
+static inline bool next_field(const char *&p, const char *end,
+                              const char *&field, size_t &len) {
+    while (p < end && is_space(*p)) {
+        p++;
+    }
+    if (p == end) {
+        return false;
+    }
+    field = p;
+    while (p < end && !is_space(*p)) {
+        p++;
+    }
+    len = p - field;
+    return true;
+}
+
+static inline void parse_string(const char *&p, const char *end, string &s) {
+    const char *field;
+    size_t len;
+    if (next_field(p, end, field, len)) {
+        s.assign(field, len);
+    }
+    else {
+        s.clear();
+    }
+}
+
+// Parses an optional sign and the leading decimal digits of a field,
+// ignoring anything after them, so that "0.5" gives 0 and "12cM" 12. A
+// field without leading digits gives 0, and values beyond the range of
+// int are clamped to it
+static inline void parse_int(const char *&p, const char *end, int &value) {
+    const char *field;
+    size_t len;
+    value = 0;
+    if (!next_field(p, end, field, len)) {
+        return;
+    }
+
+    const char *q = field, *field_end = field + len;
+    bool negative = false;
+    if (q < field_end && (*q == '-' || *q == '+')) {
+        negative = *q == '-';
+        q++;
+    }
+    long n = 0;
+    for (; q < field_end && *q >= '0' && *q <= '9'; q++) {
+        n = n * 10 + (*q - '0');
+        if (n > 2147483648L) {
+            break;
+        }
+    }
+    value = negative ? (int) -std::min(n, 2147483648L) :
+        (int) std::min(n, 2147483647L);
+}
+
+// The end of the line starting at p, excluding the newline
+static inline const char *line_end(const char *p, const char *end) {
+    const char *nl = (const char *) memchr(p, '\n', end - p);
+    return nl ? nl : end;
+}
+
+static void parse_bim_lines(const char *p, const char *end,
+                            vector<gftools::snp> &snps) {
+    while (p < end) {
+        const char *eol = line_end(p, end);
+        snps.resize(snps.size() + 1);
+        gftools::parse_bim_record(p, eol, snps.back());
+        p = eol + 1;
+    }
+}
+
+namespace {
+    struct bim_chunk {
+        const char *begin;
+        const char *end;
+        vector<gftools::snp> snps;
+    };
+
+    void *parse_bim_chunk(void *arg) {
+        bim_chunk *chunk = (bim_chunk *) arg;
+        // Estimate the number of records from a typical record length
+        chunk->snps.reserve((chunk->end - chunk->begin) / 24);
+        parse_bim_lines(chunk->begin, chunk->end, chunk->snps);
+        return NULL;
+    }
+}
+
+namespace gftools {
+
+    mapped_file::mapped_file() : map(NULL), len(0) {}
+
+    mapped_file::~mapped_file() {
+        close();
+    }
+
+    bool mapped_file::open(const string &filename) {
+        close();
+
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            int error = errno;
+            ::close(fd);
+            errno = error;
+            return false;
+        }
+
+        if (S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                map = (char *) p;
+                len = st.st_size;
+                madvise(map, len, MADV_SEQUENTIAL);
+                ::close(fd);
+                return true;
+            }
+        }
+
+        // Not a regular file, or not mappable: read it all
+        char chunk[65536];
+        while (true) {
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                int error = errno;
+                ::close(fd);
+                errno = error;
+                return false;
+            }
+            if (n == 0) {
+                break;
+            }
+            buffer.insert(buffer.end(), chunk, chunk + n);
+        }
+        len = buffer.size();
+        ::close(fd);
+        return true;
+    }
+
+    void mapped_file::close() {
+        if (map) {
+            munmap(map, len);
+            map = NULL;
+        }
+        buffer.clear();
+        len = 0;
+    }
+
+    const char *mapped_file::data() const {
+        if (map) {
+            return map;
+        }
+        return buffer.empty() ? NULL : &buffer[0];
+    }
+
+    void parse_bim_record(const char *begin, const char *end, snp &snp) {
+        const char *p = begin;
+        parse_string(p, end, snp.chromosome);
+        parse_string(p, end, snp.name);
+        parse_int(p, end, snp.genetic_position);
+        parse_int(p, end, snp.physical_position);
+        parse_string(p, end, snp.allele_a);
+        parse_string(p, end, snp.allele_b);
+    }
+
+    void parse_fam_record(const char *begin, const char *end,
+                          individual &ind) {
+        const char *p = begin;
+        parse_string(p, end, ind.family);
+        parse_string(p, end, ind.name);
+        parse_string(p, end, ind.father);
+        parse_string(p, end, ind.mother);
+        parse_string(p, end, ind.sex);
+        parse_string(p, end, ind.phenotype);
+    }
+
+    void parse_bim(const char *text, size_t len, vector<snp> &snps,
+                   int threads) {
+        const char *end = text + len;
+        if (threads < 1) {
+            threads = std::min((size_t) cpu_count(),
+                               std::max((size_t) 1, len / PARALLEL_PARSE_BYTES));
+        }
+
+        if (threads == 1) {
+            parse_bim_lines(text, end, snps);
+            return;
+        }
+
+        // Split after newlines, so that each chunk holds whole lines
+        vector<bim_chunk> chunks(threads);
+        const char *p = text;
+        for (int i = 0; i < threads; i++) {
+            chunks[i].begin = p;
+            if (i == threads - 1) {
+                p = end;
+            }
+            else {
+                p = std::max(p, text + len / threads * (i + 1));
+                p = p < end ? line_end(p, end) : end;
+                p = p < end ? p + 1 : end;
+            }
+            chunks[i].end = p;
+        }
+
+        vector<pthread_t> ids(threads);
+        int started = 0;
+        for (int i = 1; i < threads; i++) {
+            if (pthread_create(&ids[i], NULL, parse_bim_chunk, &chunks[i])) {
+                break;
+            }
+            started++;
+        }
+        parse_bim_chunk(&chunks[0]);
+        for (int i = 1; i <= started; i++) {
+            pthread_join(ids[i], NULL);
+        }
+        // Any chunks that could not be given a thread are parsed here
+        for (int i = started + 1; i < threads; i++) {
+            parse_bim_chunk(&chunks[i]);
+        }
+
+        size_t total = snps.size();
+        for (int i = 0; i < threads; i++) {
+            total += chunks[i].snps.size();
+        }
+        snps.reserve(total);
+        for (int i = 0; i < threads; i++) {
+            vector<snp> &chunk = chunks[i].snps;
+            size_t first = snps.size();
+            snps.resize(first + chunk.size());
+            for (size_t j = 0; j < chunk.size(); j++) {
+                snps[first + j].genetic_position = chunk[j].genetic_position;
+                snps[first + j].physical_position = chunk[j].physical_position;
+                snps[first + j].name.swap(chunk[j].name);
+                snps[first + j].chromosome.swap(chunk[j].chromosome);
+                snps[first + j].allele_a.swap(chunk[j].allele_a);
+                snps[first + j].allele_b.swap(chunk[j].allele_b);
+            }
+        }
+    }
+
+    void parse_fam(const char *text, size_t len,
+                   vector<individual> &individuals) {
+        const char *p = text, *end = text + len;
+        while (p < end) {
+            const char *eol = line_end(p, end);
+            individuals.resize(individuals.size() + 1);
+            parse_fam_record(p, eol, individuals.back());
+            p = eol + 1;
+        }
+    }
+}
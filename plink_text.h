@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GFTOOLS_PLINK_TEXT_H
+#define GFTOOLS_PLINK_TEXT_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "individual.h"
+#include "snp.h"
+
+namespace gftools {
+    /** A text file mapped into memory for parsing, or read into a buffer
+     * where it cannot be mapped.
+     */
+    class mapped_file {
+private:
+        char *map;
+        size_t len;
+        std::vector<char> buffer;
+
+        // Not copyable
+        mapped_file(const mapped_file &other);
+        mapped_file &operator=(const mapped_file &other);
+
+public:
+        mapped_file();
+
+        ~mapped_file();
+
+        /** Maps a file, replacing any file already mapped.
+         *
+         * @param filename The file name.
+         * @return false if the file could not be opened or read, with
+         * errno set.
+         */
+        bool open(const std::string &filename);
+
+        /** Unmaps the file.
+         */
+        void close();
+
+        /** Returns the contents of the file.
+         */
+        const char *data() const;
+
+        /** Returns the length of the file.
+         */
+        size_t size() const {
+            return len;
+        }
+    };
+
+    /** Parses one Plink BIM record, of whitespace-separated fields.
+     * Missing fields are left empty, or 0 for positions.
+     *
+     * @param begin The start of the record.
+     * @param end The end of the record.
+     * @param snp A SNP, overwritten.
+     */
+    void parse_bim_record(const char *begin, const char *end, snp &snp);
+
+    /** Parses one Plink FAM record, of whitespace-separated fields.
+     * Missing fields are left empty.
+     *
+     * @param begin The start of the record.
+     * @param end The end of the record.
+     * @param ind An individual, overwritten.
+     */
+    void parse_fam_record(const char *begin, const char *end,
+                          individual &ind);
+
+    /** Parses the records of a BIM file, one per line, appending them to a
+     * vector of SNPs. Large files are split at line boundaries into chunks
+     * that are parsed in parallel.
+     *
+     * @param text The contents of the file.
+     * @param len The length of the contents.
+     * @param snps A vector of SNPs.
+     * @param threads The number of threads, or 0 to use one per online CPU
+     * if the file is large enough to benefit.
+     */
+    void parse_bim(const char *text, size_t len, std::vector<snp> &snps,
+                   int threads = 0);
+
+    /** Parses the records of a FAM file, one per line, appending them to a
+     * vector of individuals.
+     *
+     * @param text The contents of the file.
+     * @param len The length of the contents.
+     * @param individuals A vector of individuals.
+     */
+    void parse_fam(const char *text, size_t len,
+                   std::vector<individual> &individuals);
+}
+
+#endif // GFTOOLS_PLINK_TEXT_H
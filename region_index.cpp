@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <climits>
+#include <stdint.h>
+
+#include "chromosome.h"
+#include "region_index.h"
+#include "utilities.h"
+
+using std::string;
+using std::vector;
+
+namespace gftools {
+
+    region_index::region_index(const vector<snp> &snps) {
+        // BIM files are normally sorted by chromosome, so key each name once
+        const string *last = NULL;
+        positions *p = NULL;
+        for (size_t i = 0; i < snps.size(); i++) {
+            const string &name = snps[i].chromosome;
+            if (!last || name != *last) {
+                p = &chromosomes[key(name)];
+                last = &name;
+            }
+            p->push_back(std::make_pair(snps[i].physical_position, (int) i));
+        }
+        sort_positions();
+    }
+
+    region_index::region_index(const snp_table &snps) {
+        const string *last = NULL;
+        positions *p = NULL;
+        for (size_t i = 0; i < snps.size(); i++) {
+            const string &name = snps.chromosome(i);
+            if (!last || name != *last) {
+                p = &chromosomes[key(name)];
+                last = &name;
+            }
+            p->push_back(std::make_pair(snps.physical_position(i), (int) i));
+        }
+        sort_positions();
+    }
+
+    // Chromosomes with a Plink code are keyed by it, so that e.g. "X",
+    // "chrX" and "23" are the same; others, such as unplaced contigs, by
+    // their names
+    string region_index::key(const string &chromosome) {
+        int code = chromosome_code(chromosome);
+        return code == 0 ? chromosome : chromosome_name(code);
+    }
+
+    void region_index::sort_positions() {
+        // Stable, so that BIM files sorted by position need no reordering
+        std::map<string, positions>::iterator it;
+        for (it = chromosomes.begin(); it != chromosomes.end(); it++) {
+            std::stable_sort(it->second.begin(), it->second.end());
+        }
+    }
+
+    void region_index::find(const string &chromosome, int start, int end,
+                            vector<snp_range> &ranges) const {
+        ranges.clear();
+
+        std::map<string, positions>::const_iterator it =
+            chromosomes.find(key(chromosome));
+        if (it == chromosomes.end() || start > end) {
+            return;
+        }
+
+        const positions &p = it->second;
+        positions::const_iterator lo =
+            std::lower_bound(p.begin(), p.end(), std::make_pair(start, INT_MIN));
+        positions::const_iterator hi =
+            std::upper_bound(p.begin(), p.end(), std::make_pair(end, INT_MAX));
+
+        vector<int> indices;
+        for (positions::const_iterator i = lo; i != hi; i++) {
+            indices.push_back(i->second);
+        }
+        std::sort(indices.begin(), indices.end());
+
+        // Merge into runs of consecutive indices
+        for (size_t i = 0; i < indices.size(); i++) {
+            if (!ranges.empty() &&
+                ranges.back().first + ranges.back().count == indices[i]) {
+                ranges.back().count++;
+            }
+            else {
+                ranges.push_back(snp_range(indices[i], 1));
+            }
+        }
+    }
+
+    void region_index::find(const string &chromosome,
+                            vector<snp_range> &ranges) const {
+        find(chromosome, INT_MIN, INT_MAX, ranges);
+    }
+
+    // Saved as: the number of chromosomes, then for each the length of its
+    // key and its number of positions, the key and the (position, SNP
+    // index) pairs
+    void region_index::save(string &out) const {
+        append_array(out, vector<uint64_t>(1, chromosomes.size()));
+        std::map<string, positions>::const_iterator it;
+        for (it = chromosomes.begin(); it != chromosomes.end(); it++) {
+            vector<uint64_t> lengths(2);
+            lengths[0] = it->first.size();
+            lengths[1] = it->second.size();
+            append_array(out, lengths);
+            append_array(out, vector<char>(it->first.begin(), it->first.end()));
+
+            vector<int32_t> pairs;
+            pairs.reserve(2 * it->second.size());
+            for (size_t i = 0; i < it->second.size(); i++) {
+                pairs.push_back(it->second[i].first);
+                pairs.push_back(it->second[i].second);
+            }
+            append_array(out, pairs);
+        }
+    }
+
+    bool region_index::load(const char *data, size_t len) {
+        chromosomes.clear();
+
+        const char *p = data, *end = data + len;
+        vector<uint64_t> count, lengths;
+        vector<char> name;
+        vector<int32_t> pairs;
+        bool ok = read_array(p, end, 1, count) && count[0] <= len;
+        for (size_t i = 0; ok && i < count[0]; i++) {
+            ok = read_array(p, end, 2, lengths) && lengths[1] <= len &&
+                read_array(p, end, lengths[0], name) &&
+                read_array(p, end, 2 * lengths[1], pairs);
+            if (ok) {
+                positions &chromosome =
+                    chromosomes[string(name.begin(), name.end())];
+                chromosome.resize(lengths[1]);
+                for (size_t j = 0; j < lengths[1]; j++) {
+                    chromosome[j] = std::make_pair(pairs[2 * j],
+                                                   pairs[2 * j + 1]);
+                }
+            }
+        }
+
+        ok = ok && p == end;
+        if (!ok) {
+            chromosomes.clear();
+        }
+        return ok;
+    }
+}
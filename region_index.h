@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GFTOOLS_REGION_INDEX_H
+#define GFTOOLS_REGION_INDEX_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "snp.h"
+#include "snp_table.h"
+
+namespace gftools {
+    /** A run of consecutive SNPs in the BED data.
+     */
+    class snp_range {
+public:
+        /// The index of the first SNP.
+        int first;
+        /// The number of SNPs.
+        int count;
+
+        snp_range(int first = 0, int count = 0) {
+            this->first = first;
+            this->count = count;
+        }
+    };
+
+    /** An index of SNPs by chromosome and physical position, for finding
+     * the SNPs within genomic regions without scanning them all.
+     *
+     * Chromosomes are matched by their gftools::chromosome_code, so that
+     * a query for "X" finds SNPs on chromosome "23" or "chrX", and "1"
+     * those on "chr1". Names without a code are matched exactly.
+     */
+    class region_index {
+private:
+        typedef std::vector<std::pair<int, int> > positions;
+
+        // (position, SNP index) pairs of each chromosome, by position
+        std::map<std::string, positions> chromosomes;
+
+        void sort_positions();
+
+        static std::string key(const std::string &chromosome);
+
+public:
+        /** Creates an empty index.
+         */
+        region_index() {}
+
+        /** Indexes SNPs by chromosome and physical position.
+         *
+         * @param snps The SNPs, in BED order.
+         */
+        region_index(const std::vector<gftools::snp> &snps);
+
+        /** Indexes the SNPs of a table by chromosome and physical position.
+         *
+         * @param snps The SNPs, in BED order.
+         */
+        region_index(const snp_table &snps);
+
+        /** Returns true if no SNPs are indexed.
+         */
+        bool empty() const {
+            return chromosomes.empty();
+        }
+
+        /** Appends the index to a block of bytes, in a layout that load
+         * can restore without sorting.
+         *
+         * @param out The block of bytes.
+         */
+        void save(std::string &out) const;
+
+        /** Replaces the index with one saved by save.
+         *
+         * @param data The saved bytes.
+         * @param len The number of saved bytes.
+         * @return false, leaving the index empty, if the bytes are not a
+         * consistent saved index.
+         */
+        bool load(const char *data, size_t len);
+
+        /** Finds the SNPs on a chromosome with physical positions in a
+         * closed interval.
+         *
+         * @param chromosome The chromosome name.
+         * @param start The first position of the region.
+         * @param end The last position of the region.
+         * @param ranges A vector of runs of SNPs, overwritten with the
+         * matching SNPs in BED order. SNPs sorted by position give one run.
+         */
+        void find(const std::string &chromosome, int start, int end,
+                  std::vector<snp_range> &ranges) const;
+
+        /** Finds all the SNPs on a chromosome.
+         *
+         * @see find(const std::string &chromosome, int start, int end,
+         * std::vector<snp_range> &ranges)
+         */
+        void find(const std::string &chromosome,
+                  std::vector<snp_range> &ranges) const;
+    };
+}
+
+#endif // GFTOOLS_REGION_INDEX_H
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include "exceptions.h"
+#include "genotype_codec.h"
+#include "sample_subset.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GFTOOLS_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+using std::vector;
+
+// Selected calls are packed into a chunk of this many calls before
+// decoding, so that the chunk stays in L1 cache
+const size_t CHUNK_CALLS = 4096;
+
+// Each 8-byte word holds at most 32 calls
+const size_t CHUNK_WORDS = CHUNK_CALLS / 32;
+
+#ifdef GFTOOLS_X86_SIMD
+// Packs the calls selected by masks from the given words of packed data
+// contiguously into out, returning the number of calls. out must have room
+// for 8 bytes more than the calls.
+__attribute__((target("bmi2")))
+static size_t compact_bmi2(const unsigned char *packed, size_t packed_bytes,
+                           const uint32_t *words, const uint64_t *masks,
+                           const uint8_t *counts, size_t n,
+                           unsigned char *out) {
+    unsigned char *o = out;
+    uint64_t acc = 0;
+    unsigned int bits = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        size_t pos = 8 * (size_t) words[i];
+        uint64_t v = 0;
+        memcpy(&v, packed + pos, pos + 8 <= packed_bytes ? 8 : packed_bytes - pos);
+
+        uint64_t x = _pext_u64(v, masks[i]);
+        acc |= x << bits;
+        bits += 2 * counts[i];
+        if (bits >= 64) {
+            memcpy(o, &acc, 8);
+            o += 8;
+            bits -= 64;
+            acc = bits ? x >> (2 * counts[i] - bits) : 0;
+        }
+    }
+    memcpy(o, &acc, 8);
+
+    return 4 * (o - out) + bits / 2;
+}
+#endif
+
+static bool use_bmi2() {
+    static const bool bmi2 = gftools::has_bmi2();
+    return bmi2;
+}
+
+namespace gftools {
+
+    sample_subset::sample_subset() : packed_bytes(0), sorted(true) {}
+
+    sample_subset::sample_subset(const vector<int> &indices, size_t samples)
+        : keep(indices), packed_bytes((samples + 3) / 4), sorted(true) {
+        bytes.resize(keep.size());
+        shifts.resize(keep.size());
+
+        for (size_t i = 0; i < keep.size(); i++) {
+            if (keep[i] < 0 || (size_t) keep[i] >= samples) {
+                std::stringstream ss;
+                ss << "Sample index " << keep[i] << " is outside the ";
+                ss << samples << " individuals";
+                throw malformed_data(ss.str());
+            }
+            if (i > 0 && keep[i] <= keep[i - 1]) {
+                sorted = false;
+            }
+            bytes[i] = keep[i] / 4;
+            shifts[i] = 2 * (keep[i] % 4);
+        }
+
+        if (sorted) {
+            for (size_t i = 0; i < keep.size(); i++) {
+                uint32_t word = keep[i] / 32;
+                if (words.empty() || words.back() != word) {
+                    words.push_back(word);
+                    masks.push_back(0);
+                    counts.push_back(0);
+                }
+                masks.back() |= (uint64_t) 3 << (2 * (keep[i] % 32));
+                counts.back()++;
+            }
+        }
+    }
+
+    template <typename T>
+    void sample_subset::gather(const unsigned char *packed, T *calls) const {
+        unsigned char chunk[CHUNK_CALLS / 4 + 8];
+        size_t n = keep.size();
+
+#ifdef GFTOOLS_X86_SIMD
+        if (sorted && use_bmi2()) {
+            for (size_t w = 0; w < words.size(); w += CHUNK_WORDS) {
+                size_t nw = std::min(CHUNK_WORDS, words.size() - w);
+                size_t len = compact_bmi2(packed, packed_bytes, &words[w],
+                                          &masks[w], &counts[w], nw, chunk);
+                unpack_calls(chunk, len, calls);
+                calls += len;
+            }
+            return;
+        }
+#endif
+
+        for (size_t i = 0; i < n; i += CHUNK_CALLS) {
+            size_t len = std::min(CHUNK_CALLS, n - i);
+            memset(chunk, 0, (len + 3) / 4);
+            for (size_t j = 0; j < len; j++) {
+                unsigned char c = (packed[bytes[i + j]] >> shifts[i + j]) & 3;
+                chunk[j / 4] |= c << (2 * (j % 4));
+            }
+            unpack_calls(chunk, len, calls + i);
+        }
+    }
+
+    void sample_subset::extract(const unsigned char *packed,
+                                uint8_t *calls) const {
+        gather(packed, calls);
+    }
+
+    void sample_subset::extract(const unsigned char *packed,
+                                int *calls) const {
+        gather(packed, calls);
+    }
+}
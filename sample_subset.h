@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GFTOOLS_SAMPLE_SUBSET_H
+#define GFTOOLS_SAMPLE_SUBSET_H
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+namespace gftools {
+    /** A selection of the individuals of a dataset, used to decode the
+     * calls of only those individuals from packed BED data.
+     *
+     * The byte and shift of each selected call are computed once. When the
+     * selection is in increasing order and the CPU supports BMI2, the
+     * selected calls are gathered 32 at a time with bit extraction.
+     */
+    class sample_subset {
+private:
+        std::vector<int> keep;
+        size_t packed_bytes;
+        bool sorted;
+
+        // gather table: the byte holding each selected call, and its shift
+        std::vector<uint32_t> bytes;
+        std::vector<uint8_t> shifts;
+
+        // for bit extraction: the 8-byte words holding selected calls, the
+        // selecting masks and the number of selected calls in each
+        std::vector<uint32_t> words;
+        std::vector<uint64_t> masks;
+        std::vector<uint8_t> counts;
+
+        template <typename T>
+        void gather(const unsigned char *packed, T *calls) const;
+
+public:
+        /** Creates an empty subset.
+         */
+        sample_subset();
+
+        /** Creates a subset of individuals.
+         *
+         * @param indices The indices of the selected individuals, in the
+         * order their calls are to be returned. An individual may be
+         * selected more than once.
+         * @param samples The number of individuals in the dataset.
+         */
+        sample_subset(const std::vector<int> &indices, size_t samples);
+
+        /** Returns the indices of the selected individuals.
+         */
+        const std::vector<int> &indices() const {
+            return keep;
+        }
+
+        /** Returns the number of selected individuals.
+         */
+        size_t size() const {
+            return keep.size();
+        }
+
+        /** Returns true if no individuals are selected.
+         */
+        bool empty() const {
+            return keep.empty();
+        }
+
+        /** Decodes the calls of the selected individuals from the packed
+         * calls of one SNP.
+         *
+         * @param packed The packed calls of all individuals.
+         * @param calls An array of at least size() genotype call codes,
+         * overwritten.
+         */
+        void extract(const unsigned char *packed, uint8_t *calls) const;
+
+        /** Decodes the calls of the selected individuals from the packed
+         * calls of one SNP, as integers.
+         *
+         * @see extract(const unsigned char *packed, uint8_t *calls)
+         */
+        void extract(const unsigned char *packed, int *calls) const;
+    };
+}
+
+#endif // GFTOOLS_SAMPLE_SUBSET_H
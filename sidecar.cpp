@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "plink_text.h"
+#include "sidecar.h"
+
+using std::string;
+using std::vector;
+
+// The layout is in native byte order, and is only read back on machines
+// that agree on the byte order word. All fields are 64-bit words, or
+// padded to them:
+//
+//   magic, byte order word
+//   size, mtime seconds, mtime nanoseconds of each of BIM, FAM and BED
+//   number of individuals, length of the SNP table, length of the region
+//   index
+//   the family, name, father, mother, sex and phenotype columns of the
+//   individuals
+//   the SNP table, as saved by snp_table::save
+//   the region index, as saved by region_index::save
+//
+// A column is the n + 1 offsets of its strings, then the strings.
+static const char SIDECAR_MAGIC[8] = { 'G', 'F', 'I', 'D', 'X', 0, 0, 2 };
+static const uint64_t SIDECAR_BYTE_ORDER = 0x0102030405060708ULL;
+static const size_t HEADER_WORDS = 1 + 1 + 9 + 3;
+
+static const char *SIDECAR_SUFFIX = ".gfidx";
+static const char *SOURCE_SUFFIXES[3] = { ".bim", ".fam", ".bed" };
+
+static string gftools::individual::*const INDIVIDUAL_COLUMNS[6] = {
+    &gftools::individual::family, &gftools::individual::name,
+    &gftools::individual::father, &gftools::individual::mother,
+    &gftools::individual::sex, &gftools::individual::phenotype
+};
+
+static void pad(string &out) {
+    out.append((8 - out.size() % 8) % 8, '\0');
+}
+
+template <typename T>
+static void append_column(string &out, const vector<T> &records,
+                          string T::*field) {
+    vector<uint64_t> offsets(records.size() + 1);
+    for (size_t i = 0; i < records.size(); i++) {
+        offsets[i + 1] = offsets[i] + (records[i].*field).size();
+    }
+    out.append((const char *) &offsets[0], offsets.size() * sizeof(uint64_t));
+    for (size_t i = 0; i < records.size(); i++) {
+        out.append(records[i].*field);
+    }
+    pad(out);
+}
+
+template <typename T>
+static bool read_column(const char *&p, const char *end, vector<T> &records,
+                        string T::*field) {
+    size_t n = records.size();
+    size_t offsets_len = (n + 1) * sizeof(uint64_t);
+    if ((size_t) (end - p) < offsets_len) {
+        return false;
+    }
+
+    const uint64_t *offsets = (const uint64_t *) p;
+    const char *strings = p + offsets_len;
+    uint64_t total = offsets[n];
+    if (offsets[0] != 0 || total > (uint64_t) (end - strings)) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (offsets[i + 1] < offsets[i] || offsets[i + 1] > total) {
+            return false;
+        }
+        (records[i].*field).assign(strings + offsets[i],
+                                   offsets[i + 1] - offsets[i]);
+    }
+
+    p = strings + total + (8 - total % 8) % 8;
+    return p <= end;
+}
+
+namespace gftools {
+
+    bool source_stamps::take(const string &dataset) {
+        for (int i = 0; i < 3; i++) {
+            struct stat st;
+            if (stat((dataset + SOURCE_SUFFIXES[i]).c_str(), &st) == -1) {
+                return false;
+            }
+            words[3 * i] = st.st_size;
+            words[3 * i + 1] = st.st_mtim.tv_sec;
+            words[3 * i + 2] = st.st_mtim.tv_nsec;
+        }
+        return true;
+    }
+
+    bool source_stamps::operator==(const source_stamps &other) const {
+        return memcmp(words, other.words, sizeof(words)) == 0;
+    }
+
+    bool read_sidecar(const string &dataset, const source_stamps &stamps,
+                      snp_table &snps, vector<individual> &individuals,
+                      region_index &regions) {
+        mapped_file file;
+        if (!file.open(dataset + SIDECAR_SUFFIX) ||
+            file.size() < HEADER_WORDS * sizeof(uint64_t)) {
+            return false;
+        }
+
+        const char *p = file.data(), *end = p + file.size();
+        uint64_t header[HEADER_WORDS];
+        memcpy(header, p, sizeof(header));
+        p += sizeof(header);
+
+        if (memcmp(header, SIDECAR_MAGIC, 8) != 0 ||
+            header[1] != SIDECAR_BYTE_ORDER ||
+            memcmp(header + 2, stamps.words, sizeof(stamps.words)) != 0) {
+            return false;
+        }
+
+        uint64_t n_individuals = header[11];
+        uint64_t table_len = header[12], regions_len = header[13];
+        if (n_individuals > file.size() / 8) {
+            return false;
+        }
+
+        individuals.assign(n_individuals, individual());
+        bool ok = true;
+        for (int i = 0; ok && i < 6; i++) {
+            ok = read_column(p, end, individuals, INDIVIDUAL_COLUMNS[i]);
+        }
+        ok = ok && table_len <= (uint64_t) (end - p) &&
+            regions_len == (uint64_t) (end - p) - table_len &&
+            snps.load(p, table_len) &&
+            regions.load(p + table_len, regions_len) && !snps.empty();
+
+        if (!ok) {
+            snps.clear();
+            individuals.clear();
+            regions = region_index();
+        }
+        return ok;
+    }
+
+    bool write_sidecar(const string &dataset, const source_stamps &stamps,
+                       const snp_table &snps,
+                       const vector<individual> &individuals,
+                       const region_index &regions) {
+        uint64_t header[HEADER_WORDS];
+        memcpy(header, SIDECAR_MAGIC, 8);
+        header[1] = SIDECAR_BYTE_ORDER;
+        memcpy(header + 2, stamps.words, sizeof(stamps.words));
+        header[11] = individuals.size();
+
+        string out((const char *) header, sizeof(header));
+        for (int i = 0; i < 6; i++) {
+            append_column(out, individuals, INDIVIDUAL_COLUMNS[i]);
+        }
+        size_t table_start = out.size();
+        snps.save(out);
+        size_t regions_start = out.size();
+        regions.save(out);
+
+        uint64_t lengths[2] = { regions_start - table_start,
+                                out.size() - regions_start };
+        memcpy(&out[12 * sizeof(uint64_t)], lengths, sizeof(lengths));
+
+        // Write beside the sidecar, then rename over it, so that readers
+        // never see a partial file
+        std::stringstream tmp;
+        tmp << dataset << SIDECAR_SUFFIX << ".tmp." << getpid();
+        std::ofstream file(tmp.str().c_str(),
+                           std::ios::out | std::ios::binary | std::ios::trunc);
+        file.write(out.data(), out.size());
+        file.close();
+
+        // Sources changed while they were read, or since, would be
+        // recorded with stamps that do not describe them
+        source_stamps now;
+        if (!file || !now.take(dataset) || !(now == stamps) ||
+            rename(tmp.str().c_str(), (dataset + SIDECAR_SUFFIX).c_str()) == -1) {
+            remove(tmp.str().c_str());
+            return false;
+        }
+        return true;
+    }
+}
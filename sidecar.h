@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GFTOOLS_SIDECAR_H
+#define GFTOOLS_SIDECAR_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "individual.h"
+#include "region_index.h"
+#include "snp_table.h"
+
+namespace gftools {
+    /** The size and modification time of the BIM, FAM and BED files of a
+     * dataset, which a sidecar records to tell whether it is current.
+     */
+    class source_stamps {
+public:
+        /// Size, mtime seconds and mtime nanoseconds of each file.
+        uint64_t words[9];
+
+        /** Takes the stamps of the files of a dataset.
+         *
+         * @param dataset The dataset name.
+         * @return false if any of the files is missing.
+         */
+        bool take(const std::string &dataset);
+
+        bool operator==(const source_stamps &other) const;
+    };
+
+    /** Loads the SNPs, individuals and region index of a dataset from its
+     * binary sidecar file, dataset.gfidx, if there is one and it is
+     * current.
+     *
+     * The sidecar is ignored if the source files have changed since it
+     * was made, or if it is damaged.
+     *
+     * The SNP columns and their name index are loaded with a bulk copy
+     * each, saving parsing the text files, rehashing the names and sorting
+     * the regions. They are copied out of the mapped file rather than read
+     * in place, so that the table can outlive it.
+     *
+     * @param dataset The dataset name.
+     * @param stamps The stamps of the source files, as taken on opening.
+     * @param snps A table of SNPs, overwritten.
+     * @param individuals A vector of individuals, overwritten.
+     * @param regions An index of the SNPs by region, overwritten.
+     * @return true if the sidecar was loaded, false if the dataset must
+     * be read from the BIM and FAM files.
+     */
+    bool read_sidecar(const std::string &dataset, const source_stamps &stamps,
+                      snp_table &snps, std::vector<individual> &individuals,
+                      region_index &regions);
+
+    /** Writes the binary sidecar file of a dataset, replacing any existing
+     * one atomically. Failure, e.g. in a read-only directory, is not an
+     * error, as the sidecar only makes opening faster.
+     *
+     * Nothing is written if the source files no longer match the stamps
+     * taken before they were read, as the SNPs and individuals may then
+     * be from neither version.
+     *
+     * @param dataset The dataset name.
+     * @param stamps The stamps of the source files, taken before reading
+     * them.
+     * @param snps The SNPs, as read from the BIM file.
+     * @param individuals The individuals, as read from the FAM file.
+     * @param regions The index of the SNPs by region.
+     * @return true if the sidecar was written.
+     */
+    bool write_sidecar(const std::string &dataset, const source_stamps &stamps,
+                       const snp_table &snps,
+                       const std::vector<individual> &individuals,
+                       const region_index &regions);
+}
+
+#endif // GFTOOLS_SIDECAR_H
@@ -4,6 +4,7 @@
  * Usage: snp_af_sample_cr [ options ] PLINK_BINARY
 */
 
+#include <cstdlib>
 #include <iostream>
 #include <algorithm>
 #include <fstream>
@@ -11,13 +12,40 @@
 #include <iomanip>
 #include <getopt.h>
 #include "plink_binary.h"
+#include "snp_scan.h"
 
 using namespace std;
 
-void allele_counts(vector<int> genotypes, int &a_count, int &b_count, int &nn_count);
+void allele_counts(const uint8_t *genotypes, size_t n, int &a_count, int &b_count, int &nn_count);
 void usage(char *progname);
 bool sort_by_cr(struct sample s1, struct sample s2);
 
+// per-SNP allele counts and per-sample call and het counts, accumulated
+// over blocks of SNPs by each worker thread
+class sample_stats : public gftools::snp_scan_task
+{
+public:
+    sample_stats(const plink_binary &pb, float min_snp_cr);
+
+    gftools::snp_scan_task *clone() const;
+    void process(const gftools::snp_block &block);
+    void reduce(const gftools::snp_scan_task &other);
+
+    // shared by all copies; each SNP is written by one worker only
+    vector<int> &a_counts, &b_counts, &nn_counts;
+
+    int good_snps;
+    vector<int> x_het, x_total;
+    vector<int> aut_het, aut_total, other_total;
+
+private:
+    sample_stats(const sample_stats &other);
+
+    const plink_binary &pb;
+    float min_snp_cr;
+    vector<int> counts[3];
+};
+
 // to store results so that they can be sorted on call rate
 struct sample
 {
@@ -29,12 +57,13 @@ struct sample
 
 int main (int argc, char *argv[])
 {
-    const char* const short_options = "r:s:va:m:";
+    const char* const short_options = "r:s:va:m:t:";
     const struct option long_options[] = {
         { "snp", 1, NULL, 'r' },
         { "sample", 1, NULL, 's' },
         { "verbose", 1, NULL, 'v' },
         { "min_snp_cr", 1, NULL, 'm' },
+        { "threads", 1, NULL, 't' },
         { NULL, 0, NULL, 0 }
     };
     int opt;
@@ -42,6 +71,7 @@ int main (int argc, char *argv[])
     string snp_file("snp_cr_af.txt");
     string sample_file("sample_cr_het.txt");
     float min_snp_cr = 0.95;
+    int threads = 0;
     bool verbose;
 
     do {
@@ -59,6 +89,9 @@ int main (int argc, char *argv[])
             case 'r':
                 snp_file = optarg;
                 break;
+            case 't':
+                threads = atoi(optarg);
+                break;
         }
     } while (opt != -1);
 
@@ -76,22 +109,16 @@ int main (int argc, char *argv[])
 
     plink_binary *pb = new plink_binary(argv[optind]);
     vector<gftools::individual> samples = pb->individuals;
-    vector<int> genotypes;
-    int total_snps = 0, good_snps = 0;
-
-    vector<int> sample_x_het, sample_x_total;
-    vector<int> sample_aut_het, sample_aut_total, sample_other_total;
-    sample_x_het.resize(pb->individuals.size());
-    sample_aut_het.resize(pb->individuals.size());
-    sample_x_total.resize(pb->individuals.size());
-    sample_aut_total.resize(pb->individuals.size());
-    sample_other_total.resize(pb->individuals.size());
-
-    for (unsigned int snp = 0; snp < pb->snps.size(); snp++) {
-        pb->read_snp(snp, genotypes);
-        total_snps++;
-        int na, nn, nb;
-        allele_counts(genotypes, na, nb, nn);
+    int total_snps = pb->snps.size();
+
+    // Counts are gathered in parallel and then reported in SNP order
+    sample_stats stats(*pb, min_snp_cr);
+    gftools::parallel_scan(*pb, stats, threads);
+
+    for (int snp = 0; snp < total_snps; snp++) {
+        int na = stats.a_counts[snp];
+        int nb = stats.b_counts[snp];
+        int nn = stats.nn_counts[snp];
         float snp_cr = (float)(na + nb) / (2 * nn + na + nb);
         out_snp << fixed << pb->snps[snp].name << "\t" << setprecision(4) << snp_cr;
         if (na + nb == 0) {
@@ -118,35 +145,16 @@ int main (int argc, char *argv[])
             out_snp << "\t" << major << "\t" << 1 << "\t" << minor << "\t" << 0 << endl;
         else
             out_snp << "\t" << major << "\t" << setprecision(4) << a_freq << "\t" << minor << "\t" << setprecision(4) << 1 - a_freq << endl;
-
-        if (snp_cr < min_snp_cr)
-            continue;
-        good_snps++;
-
-        bool x_snp = pb->snps[snp].chromosome == "X" ||
-	                 pb->snps[snp].chromosome == "23";
-        bool other_snp = pb->snps[snp].chromosome == "XY" ||
-                         pb->snps[snp].chromosome == "MT" ||
-                         pb->snps[snp].chromosome == "Y" ||
-                         pb->snps[snp].chromosome == "24" ||
-                         pb->snps[snp].chromosome == "25" ||
-                         pb->snps[snp].chromosome == "26";
-
-        for (unsigned int ind = 0; ind < genotypes.size(); ind++) {
-            if (genotypes[ind] == 0) continue;
-	    if (other_snp) {
-                sample_other_total[ind]++;
-	    } else if (x_snp) {
-                sample_x_total[ind]++;
-                if (genotypes[ind] == 2) sample_x_het[ind]++;
-            } else {
-                sample_aut_total[ind]++;
-                if (genotypes[ind] == 2) sample_aut_het[ind]++;
-            }
-        }
     }
     out_snp.close();
 
+    int good_snps = stats.good_snps;
+    vector<int> &sample_x_het = stats.x_het;
+    vector<int> &sample_x_total = stats.x_total;
+    vector<int> &sample_aut_het = stats.aut_het;
+    vector<int> &sample_aut_total = stats.aut_total;
+    vector<int> &sample_other_total = stats.other_total;
+
     out_sample << "#stats from " << good_snps << "/" << total_snps << " SNPs with CR >= " << setprecision(2) << 100 * min_snp_cr << "%" << endl;
     out_sample << fixed;
 
@@ -167,12 +175,94 @@ int main (int argc, char *argv[])
     }
 }
 
+sample_stats::sample_stats(const plink_binary &pb, float min_snp_cr)
+    : a_counts(counts[0]), b_counts(counts[1]), nn_counts(counts[2]),
+      good_snps(0), pb(pb), min_snp_cr(min_snp_cr)
+{
+    size_t n = pb.individuals.size();
+    for (int i = 0; i < 3; i++)
+        counts[i].resize(pb.snps.size());
+    x_het.resize(n);
+    x_total.resize(n);
+    aut_het.resize(n);
+    aut_total.resize(n);
+    other_total.resize(n);
+}
+
+sample_stats::sample_stats(const sample_stats &other)
+    : a_counts(other.a_counts), b_counts(other.b_counts),
+      nn_counts(other.nn_counts), good_snps(0), pb(other.pb),
+      min_snp_cr(other.min_snp_cr)
+{
+    size_t n = pb.individuals.size();
+    x_het.resize(n);
+    x_total.resize(n);
+    aut_het.resize(n);
+    aut_total.resize(n);
+    other_total.resize(n);
+}
+
+gftools::snp_scan_task *sample_stats::clone() const
+{
+    return new sample_stats(*this);
+}
+
+void sample_stats::process(const gftools::snp_block &block)
+{
+    for (int i = 0; i < block.count; i++) {
+        int snp = block.first + i;
+        const uint8_t *genotypes = block.calls + i * block.samples;
+        int na, nn, nb;
+        allele_counts(genotypes, block.samples, na, nb, nn);
+        a_counts[snp] = na;
+        b_counts[snp] = nb;
+        nn_counts[snp] = nn;
+
+        float snp_cr = (float)(na + nb) / (2 * nn + na + nb);
+        if (na + nb == 0 || snp_cr < min_snp_cr)
+            continue;
+        good_snps++;
+
+        unsigned int snp_class = pb.snp_class(snp);
+        bool x_snp = snp_class == gftools::X_LINKED;
+        bool other_snp = snp_class & (gftools::Y_LINKED |
+                                      gftools::PSEUDOAUTOSOMAL |
+                                      gftools::MITOCHONDRIAL);
+
+        for (size_t ind = 0; ind < block.samples; ind++) {
+            if (genotypes[ind] == 0) continue;
+            if (other_snp) {
+                other_total[ind]++;
+            } else if (x_snp) {
+                x_total[ind]++;
+                if (genotypes[ind] == 2) x_het[ind]++;
+            } else {
+                aut_total[ind]++;
+                if (genotypes[ind] == 2) aut_het[ind]++;
+            }
+        }
+    }
+}
+
+void sample_stats::reduce(const gftools::snp_scan_task &other)
+{
+    const sample_stats &o = dynamic_cast<const sample_stats &>(other);
+    good_snps += o.good_snps;
+    for (size_t ind = 0; ind < x_het.size(); ind++) {
+        x_het[ind] += o.x_het[ind];
+        x_total[ind] += o.x_total[ind];
+        aut_het[ind] += o.aut_het[ind];
+        aut_total[ind] += o.aut_total[ind];
+        other_total[ind] += o.other_total[ind];
+    }
+}
+
 // return NN, allele counts
-void allele_counts(vector<int> genotypes, int &a_count, int &b_count, int &nn_count)
+void allele_counts(const uint8_t *genotypes, size_t n, int &a_count, int &b_count, int &nn_count)
 {
     nn_count = a_count = b_count = 0;
 
-    for (unsigned int i = 0; i < genotypes.size(); i++) {
+    for (size_t i = 0; i < n; i++) {
         switch (genotypes[i]) {
             case 0:
                 nn_count++;
@@ -204,5 +294,6 @@ void usage(char *progname)
     cout << "         -sample      output sample_file" << endl;
     cout << "         -verbose     verbose" << endl;
     cout << "         -min_snp_cr  min snp call rate" << endl;
+    cout << "         -threads     number of threads (default: one per CPU)" << endl;
 }
 
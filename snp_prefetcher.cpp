@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+
+#include "utilities.h"
+#include "snp_prefetcher.h"
+
+using std::string;
+using std::vector;
+
+namespace gftools {
+
+    snp_prefetcher::snp_prefetcher(const plink_binary &pb, int depth)
+        : pb(pb), first(0), count(pb.snp_count()), depth(depth) {
+        start();
+    }
+
+    snp_prefetcher::snp_prefetcher(const plink_binary &pb, int first,
+                                   int count, int depth)
+        : pb(pb), first(first), count(count), depth(depth) {
+        start();
+    }
+
+    snp_prefetcher::~snp_prefetcher() {
+        close();
+        pthread_cond_destroy(&not_full);
+        pthread_cond_destroy(&not_empty);
+        pthread_mutex_destroy(&lock);
+    }
+
+    void snp_prefetcher::start() {
+        if (first < 0 || count < 0 || (size_t) first + count > pb.snp_count()) {
+            throw malformed_data("SNP range to prefetch is outside " +
+                                 pb.dataset);
+        }
+        if (depth < 1) {
+            throw malformed_data("Prefetch depth must be positive");
+        }
+
+        samples = pb.call_count();
+        ring.resize(std::max((size_t) 1, depth * samples));
+        started = stopping = failed = false;
+        head = tail = 0;
+
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&not_empty, NULL);
+        pthread_cond_init(&not_full, NULL);
+
+        if (count > 0) {
+            int rc = pthread_create(&thread, NULL, run_thread, this);
+            if (rc) {
+                // The destructor does not run when the constructor throws
+                pthread_cond_destroy(&not_full);
+                pthread_cond_destroy(&not_empty);
+                pthread_mutex_destroy(&lock);
+                throw malformed_data("Failed to start prefetch thread: " +
+                                     error_message(rc));
+            }
+            started = true;
+        }
+    }
+
+    void *snp_prefetcher::run_thread(void *arg) {
+        ((snp_prefetcher *) arg)->run();
+        return NULL;
+    }
+
+    void snp_prefetcher::run() {
+        // Decode in batches, so that the caller can start on the first
+        // SNPs while the rest of the ring is filled
+        const int batch = std::max(1, depth / 4);
+        vector<unsigned char> buffer; // only used if not memory-mapped
+        int hinted = 0;
+
+        while (true) {
+            pthread_mutex_lock(&lock);
+            while (tail - head == depth && !stopping) {
+                pthread_cond_wait(&not_full, &lock);
+            }
+            int begin = tail;
+            int n = std::min(depth - (tail - head), count - tail);
+            n = std::min(n, depth - tail % depth); // don't wrap
+            n = std::min(n, batch);
+            bool stop = stopping;
+            pthread_mutex_unlock(&lock);
+
+            if (stop || n == 0) {
+                break;
+            }
+
+            try {
+                // Keep the kernel a ring's worth ahead of the decoder
+                int ahead = std::min(count, begin + n + depth);
+                if (ahead > hinted) {
+                    pb.prefetch_snps(first + hinted, ahead - hinted);
+                    hinted = ahead;
+                }
+
+                packed_snps view = pb.view_snps(first + begin, n, buffer);
+                for (int i = 0; i < n; i++) {
+                    pb.decode_calls(view[i],
+                                    &ring[((begin + i) % depth) * samples]);
+                }
+            }
+            catch (std::exception &e) {
+                pthread_mutex_lock(&lock);
+                failed = true;
+                error = e.what();
+                pthread_cond_signal(&not_empty);
+                pthread_mutex_unlock(&lock);
+                break;
+            }
+
+            pthread_mutex_lock(&lock);
+            tail += n;
+            pthread_cond_signal(&not_empty);
+            pthread_mutex_unlock(&lock);
+        }
+    }
+
+    bool snp_prefetcher::next_snp(snp &snp, vector<uint8_t> &genotypes) {
+        pthread_mutex_lock(&lock);
+        while (head == tail && tail < count && !failed && started) {
+            pthread_cond_wait(&not_empty, &lock);
+        }
+        int index = head;
+        bool ready = head < tail && !stopping;
+        bool error_reached = !ready && failed && !stopping;
+        pthread_mutex_unlock(&lock);
+
+        if (error_reached) {
+            throw malformed_data(error);
+        }
+        if (!ready) {
+            return false;
+        }
+
+        // The slot is not reused until head moves past it
+        genotypes.resize(samples);
+        if (samples > 0) {
+            memcpy(&genotypes[0], &ring[(index % depth) * samples], samples);
+        }
+        pb.snp_at(first + index, snp);
+
+        pthread_mutex_lock(&lock);
+        head++;
+        pthread_cond_signal(&not_full);
+        pthread_mutex_unlock(&lock);
+        return true;
+    }
+
+    bool snp_prefetcher::next_snp(snp &snp, vector<string> &genotypes) {
+        if (!next_snp(snp, call_buffer)) {
+            return false;
+        }
+        pb.genotypes_itoa(snp, call_buffer, genotypes);
+        return true;
+    }
+
+    void snp_prefetcher::close() {
+        if (!started) {
+            return;
+        }
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_cond_signal(&not_full);
+        pthread_mutex_unlock(&lock);
+
+        pthread_join(thread, NULL);
+        started = false;
+    }
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GFTOOLS_SNP_PREFETCHER_H
+#define GFTOOLS_SNP_PREFETCHER_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+#include "plink_binary.h"
+
+namespace gftools {
+    /** Iterates over a run of SNPs of a dataset open for reading, with a
+     * background thread reading and decoding ahead of the caller.
+     *
+     * The background thread advises the kernel of the SNPs it will read
+     * next, reads them in batches and decodes them into a ring buffer of
+     * depth SNPs, so that I/O overlaps whatever the caller does with each
+     * SNP. The dataset must stay open while the prefetcher is in use, but
+     * may be read concurrently by other const methods. Calls are returned
+     * for the individuals kept by plink_binary::keep_samples when the
+     * prefetcher was created, which must not change while it is in use.
+     */
+    class snp_prefetcher {
+private:
+        const plink_binary &pb;
+        int first;
+        int count;
+        int depth;
+        size_t samples;
+
+        std::vector<uint8_t> ring;
+        std::vector<uint8_t> call_buffer; // used by next_snp for strings
+
+        pthread_t thread;
+        pthread_mutex_t lock;
+        pthread_cond_t not_empty;
+        pthread_cond_t not_full;
+        bool started;
+        bool stopping;
+        bool failed;
+        std::string error;
+        int head; // index of the next SNP to be returned
+        int tail; // index of the next SNP to be decoded
+
+        void start();
+
+        void run();
+
+        static void *run_thread(void *arg);
+
+        // Not copyable
+        snp_prefetcher(const snp_prefetcher &other);
+        snp_prefetcher &operator=(const snp_prefetcher &other);
+
+public:
+        /** Starts prefetching all the SNPs of a dataset.
+         *
+         * @param pb A dataset open for reading.
+         * @param depth The number of SNPs to decode ahead.
+         */
+        snp_prefetcher(const plink_binary &pb, int depth = 64);
+
+        /** Starts prefetching a run of consecutive SNPs of a dataset.
+         *
+         * @param pb A dataset open for reading.
+         * @param first The index of the first SNP.
+         * @param count The number of SNPs.
+         * @param depth The number of SNPs to decode ahead.
+         */
+        snp_prefetcher(const plink_binary &pb, int first, int count,
+                       int depth = 64);
+
+        ~snp_prefetcher();
+
+        /** Returns the next SNP and its genotype call codes.
+         *
+         * If the background thread failed to read a SNP, the error is
+         * thrown as malformed_data when that SNP is reached.
+         *
+         * @param snp A SNP, overwritten.
+         * @param genotypes A vector of genotype call codes, overwritten.
+         * @return true if a SNP was returned, false at the end of the run.
+         */
+        bool next_snp(gftools::snp &snp, std::vector<uint8_t> &genotypes);
+
+        /** Returns the next SNP and its genotype calls as strings, formatted
+         * as by plink_binary::genotypes_itoa.
+         *
+         * @see next_snp(gftools::snp &snp, std::vector<uint8_t> &genotypes)
+         */
+        bool next_snp(gftools::snp &snp, std::vector<std::string> &genotypes);
+
+        /** Stops the background thread, after which next_snp returns
+         * false. Called by the destructor.
+         */
+        void close();
+    };
+}
+
+#endif // GFTOOLS_SNP_PREFETCHER_H
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <exception>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#include "utilities.h"
+#include "snp_scan.h"
+
+using std::string;
+using std::vector;
+
+// Aim for about this many bytes of decoded calls per block
+const size_t DEFAULT_BLOCK_BYTES = 1 << 20;
+
+namespace {
+    // A run of blocks owned by one worker, from which others may steal
+    struct block_range {
+        pthread_mutex_t lock;
+        size_t begin;
+        size_t end;
+    };
+
+    struct scan_state {
+        const plink_binary *pb;
+        int first;
+        int count;
+        int block_size;
+        bool decode;
+        vector<block_range> ranges;
+
+        pthread_mutex_t error_lock;
+        bool failed;
+        string error;
+    };
+
+    struct worker {
+        scan_state *state;
+        size_t id;
+        gftools::snp_scan_task *task;
+    };
+
+    bool take_block(block_range &range, size_t &block) {
+        bool taken = false;
+        pthread_mutex_lock(&range.lock);
+        if (range.begin < range.end) {
+            block = range.begin++;
+            taken = true;
+        }
+        pthread_mutex_unlock(&range.lock);
+        return taken;
+    }
+
+    // Moves the upper half of the blocks of another worker to this one
+    bool steal_blocks(scan_state *state, size_t thief) {
+        size_t n = state->ranges.size();
+        for (size_t i = 1; i < n; i++) {
+            block_range &victim = state->ranges[(thief + i) % n];
+            size_t begin = 0, end = 0;
+
+            pthread_mutex_lock(&victim.lock);
+            if (victim.begin < victim.end) {
+                end = victim.end;
+                begin = end - (end - victim.begin + 1) / 2;
+                victim.end = begin;
+            }
+            pthread_mutex_unlock(&victim.lock);
+
+            if (begin < end) {
+                block_range &own = state->ranges[thief];
+                pthread_mutex_lock(&own.lock);
+                own.begin = begin;
+                own.end = end;
+                pthread_mutex_unlock(&own.lock);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void fail(scan_state *state, const string &error) {
+        pthread_mutex_lock(&state->error_lock);
+        if (!state->failed) {
+            state->failed = true;
+            state->error = error;
+        }
+        pthread_mutex_unlock(&state->error_lock);
+    }
+
+    bool has_failed(scan_state *state) {
+        pthread_mutex_lock(&state->error_lock);
+        bool failed = state->failed;
+        pthread_mutex_unlock(&state->error_lock);
+        return failed;
+    }
+
+    void process_block(scan_state *state, gftools::snp_scan_task *task,
+                       size_t block, vector<unsigned char> &packed,
+                       vector<uint8_t> &calls) {
+        const plink_binary &pb = *state->pb;
+        gftools::snp_block b;
+        b.first = state->first + block * state->block_size;
+        b.count = std::min(state->block_size,
+                           state->first + state->count - b.first);
+        b.samples = pb.call_count();
+        b.packed = pb.view_snps(b.first, b.count, packed);
+        b.calls = NULL;
+
+        if (state->decode) {
+            // Keeping only the individuals selected by keep_samples
+            calls.resize(b.count * b.samples);
+            for (int i = 0; i < b.count; i++) {
+                pb.decode_calls(b.packed[i], &calls[i * b.samples]);
+            }
+            b.calls = calls.empty() ? NULL : &calls[0];
+        }
+
+        task->process(b);
+    }
+
+    void *run_worker(void *arg) {
+        worker *w = (worker *) arg;
+        scan_state *state = w->state;
+        vector<unsigned char> packed;
+        vector<uint8_t> calls;
+
+        try {
+            size_t block;
+            do {
+                while (take_block(state->ranges[w->id], block)) {
+                    if (has_failed(state)) {
+                        return NULL;
+                    }
+                    process_block(state, w->task, block, packed, calls);
+                }
+            } while (steal_blocks(state, w->id));
+        }
+        catch (std::exception &e) {
+            fail(state, e.what());
+        }
+        catch (...) {
+            fail(state, "Unknown error in SNP scan");
+        }
+        return NULL;
+    }
+}
+
+namespace gftools {
+
+    void parallel_scan(const plink_binary &pb, snp_scan_task &task,
+                       int first, int count, int threads, int block_size) {
+        if (first < 0 || count < 0 || (size_t) first + count > pb.snp_count()) {
+            std::stringstream ss;
+            ss << "SNP range " << first << "+" << count;
+            ss << " is outside the " << pb.snp_count() << " SNPs of ";
+            ss << pb.dataset;
+            throw malformed_data(ss.str());
+        }
+        if (block_size < 1) {
+            throw malformed_data("SNP scan block size must be positive");
+        }
+        if (threads < 1) {
+            threads = cpu_count();
+        }
+
+        size_t blocks = (count + block_size - 1) / block_size;
+        if ((size_t) threads > blocks) {
+            threads = std::max((size_t) 1, blocks);
+        }
+
+        scan_state state;
+        state.pb = &pb;
+        state.first = first;
+        state.count = count;
+        state.block_size = block_size;
+        state.decode = task.decode();
+        state.failed = false;
+        state.ranges.resize(threads);
+        pthread_mutex_init(&state.error_lock, NULL);
+
+        // Initially, each worker owns a contiguous run of blocks
+        for (int i = 0; i < threads; i++) {
+            pthread_mutex_init(&state.ranges[i].lock, NULL);
+            state.ranges[i].begin = blocks * i / threads;
+            state.ranges[i].end = blocks * (i + 1) / threads;
+        }
+
+        vector<worker> workers(threads);
+        vector<pthread_t> ids(threads);
+        int started = 0;
+
+        if (threads == 1) {
+            workers[0].state = &state;
+            workers[0].id = 0;
+            workers[0].task = &task;
+            run_worker(&workers[0]);
+        }
+        else {
+            for (int i = 0; i < threads; i++) {
+                workers[i].state = &state;
+                workers[i].id = i;
+                workers[i].task = NULL;
+            }
+            try {
+                for (int i = 0; i < threads; i++) {
+                    workers[i].task = task.clone();
+                }
+            }
+            catch (std::exception &e) {
+                fail(&state, e.what());
+            }
+
+            for (int i = 0; i < threads && !has_failed(&state); i++) {
+                int rc = pthread_create(&ids[i], NULL, run_worker, &workers[i]);
+                if (rc) {
+                    fail(&state, "Failed to start SNP scan thread: " +
+                         error_message(rc));
+                    break;
+                }
+                started++;
+            }
+            for (int i = 0; i < started; i++) {
+                pthread_join(ids[i], NULL);
+            }
+
+            // Any blocks of workers that failed to start are left undone,
+            // but then the scan has failed anyway
+            for (int i = 0; i < threads; i++) {
+                if (workers[i].task) {
+                    if (!state.failed) {
+                        task.reduce(*workers[i].task);
+                    }
+                    delete workers[i].task;
+                }
+            }
+        }
+
+        for (int i = 0; i < threads; i++) {
+            pthread_mutex_destroy(&state.ranges[i].lock);
+        }
+        pthread_mutex_destroy(&state.error_lock);
+
+        if (state.failed) {
+            throw malformed_data(state.error);
+        }
+    }
+
+    void parallel_scan(const plink_binary &pb, snp_scan_task &task,
+                       int threads) {
+        size_t samples = std::max((size_t) 1, pb.call_count());
+        int block_size = std::max((size_t) 1, DEFAULT_BLOCK_BYTES / samples);
+        parallel_scan(pb, task, 0, pb.snp_count(), threads, block_size);
+    }
+}
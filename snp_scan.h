@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GFTOOLS_SNP_SCAN_H
+#define GFTOOLS_SNP_SCAN_H
+
+#include <stdint.h>
+#include "plink_binary.h"
+
+namespace gftools {
+    /** A block of consecutive SNPs handed to a scan task.
+     */
+    class snp_block {
+public:
+        /// The index of the first SNP of the block in the BED data.
+        int first;
+        /// The number of SNPs in the block.
+        int count;
+        /// The number of decoded calls per SNP, i.e. the individuals kept
+        /// by plink_binary::keep_samples, or all of them.
+        size_t samples;
+        /// The genotype call codes of the kept individuals, in SNP-major
+        /// order, or NULL if the task does not decode.
+        const uint8_t *calls;
+        /// The packed genotype calls of the block, of all individuals.
+        packed_snps packed;
+    };
+
+    /** A computation over the SNPs of a dataset, run by parallel_scan.
+     *
+     * Each worker thread runs its own copy of the task, made by clone, so
+     * that accumulators need no locking. When the scan is complete, each
+     * copy is merged into the original task by reduce, in thread order.
+     *
+     * Which blocks each copy processes depends on work stealing, and so
+     * varies from run to run. Results are therefore only independent of
+     * scheduling if combining blocks, by process and reduce, is
+     * associative and commutative, as with sums and counts; floating-point
+     * sums, for example, may differ in their last bits.
+     */
+    class snp_scan_task {
+public:
+        virtual ~snp_scan_task() {}
+
+        /** Returns a new copy of this task, with empty accumulators, for a
+         * worker thread. The caller takes ownership.
+         */
+        virtual snp_scan_task *clone() const = 0;
+
+        /** Processes one block of SNPs.
+         *
+         * Blocks are processed in no particular order.
+         *
+         * @param block A block of SNPs.
+         */
+        virtual void process(const snp_block &block) = 0;
+
+        /** Merges the accumulators of a worker copy into this task.
+         *
+         * @param other A copy made by clone.
+         */
+        virtual void reduce(const snp_scan_task &other) = 0;
+
+        /** Returns true if blocks should be decoded into genotype call
+         * codes, false if the task only uses packed calls.
+         */
+        virtual bool decode() const {
+            return true;
+        }
+    };
+
+    /** Runs a task over a range of SNPs of a dataset open for reading.
+     *
+     * The range is divided into blocks that are shared among worker threads
+     * with work stealing: each worker starts with a contiguous run of
+     * blocks and, when it runs out, takes half of the remaining blocks of
+     * another worker. With one thread, the task is run directly on the
+     * calling thread without being cloned.
+     *
+     * If a task throws, the scan stops and the first error is rethrown as
+     * malformed_data on the calling thread.
+     *
+     * @param pb A dataset open for reading.
+     * @param task The task to run.
+     * @param first The index of the first SNP.
+     * @param count The number of SNPs.
+     * @param threads The number of worker threads, or 0 to use one per
+     * online CPU.
+     * @param block_size The number of SNPs per block.
+     */
+    void parallel_scan(const plink_binary &pb, snp_scan_task &task,
+                       int first, int count, int threads, int block_size);
+
+    /** Runs a task over all the SNPs of a dataset open for reading.
+     *
+     * @see parallel_scan(const plink_binary &pb, snp_scan_task &task,
+     * int first, int count, int threads, int block_size)
+     */
+    void parallel_scan(const plink_binary &pb, snp_scan_task &task,
+                       int threads);
+}
+
+#endif // GFTOOLS_SNP_SCAN_H
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <stdint.h>
+
+#include "snp_table.h"
+#include "utilities.h"
+
+using std::string;
+using std::vector;
+
+namespace gftools {
+
+    snp_table::snp_table() {}
+
+    snp_table::snp_table(const vector<snp> &snps) {
+        size_t bytes = 0;
+        for (size_t i = 0; i < snps.size(); i++) {
+            bytes += snps[i].name.size();
+        }
+        reserve(snps.size(), bytes);
+        for (size_t i = 0; i < snps.size(); i++) {
+            push_back(snps[i]);
+        }
+    }
+
+    uint32_t snp_table::intern(const string &symbol) {
+        int code = symbol_codes.find(symbol);
+        if (code == -1) {
+            code = symbols.size();
+            symbols.push_back(symbol);
+            symbol_codes.insert(symbol, code);
+        }
+        return code;
+    }
+
+    void snp_table::reserve(size_t snps, size_t name_bytes) {
+        genetic.reserve(snps);
+        physical.reserve(snps);
+        chromosomes.reserve(snps);
+        alleles_a.reserve(snps);
+        alleles_b.reserve(snps);
+        name_offsets.reserve(snps);
+        name_lengths.reserve(snps);
+        names.reserve(snps, name_bytes);
+    }
+
+    void snp_table::push_back(const snp &snp) {
+        genetic.push_back(snp.genetic_position);
+        physical.push_back(snp.physical_position);
+        chromosomes.push_back(intern(snp.chromosome));
+        alleles_a.push_back(intern(snp.allele_a));
+        alleles_b.push_back(intern(snp.allele_b));
+        name_offsets.push_back(names.insert(snp.name, name_offsets.size()));
+        name_lengths.push_back(snp.name.size());
+    }
+
+    void snp_table::clear() {
+        // Swap with empty containers, so that their memory is released
+        vector<int>().swap(genetic);
+        vector<int>().swap(physical);
+        vector<uint32_t>().swap(chromosomes);
+        vector<uint32_t>().swap(alleles_a);
+        vector<uint32_t>().swap(alleles_b);
+        names.clear();
+        vector<size_t>().swap(name_offsets);
+        vector<uint32_t>().swap(name_lengths);
+        vector<string>().swap(symbols);
+        symbol_codes.clear();
+    }
+
+    void snp_table::get(size_t i, snp &snp) const {
+        snp.genetic_position = genetic[i];
+        snp.physical_position = physical[i];
+        snp.name.assign(names.names(), name_offsets[i], name_lengths[i]);
+        snp.chromosome = symbols[chromosomes[i]];
+        snp.allele_a = symbols[alleles_a[i]];
+        snp.allele_b = symbols[alleles_b[i]];
+    }
+
+    snp snp_table::at(size_t i) const {
+        snp snp;
+        get(i, snp);
+        return snp;
+    }
+
+    size_t snp_table::memory_usage() const {
+        size_t bytes = sizeof(*this);
+        bytes += genetic.capacity() * sizeof(int) * 2;
+        bytes += chromosomes.capacity() * sizeof(uint32_t) * 3;
+        bytes += names.memory_usage();
+        bytes += name_offsets.capacity() * sizeof(size_t);
+        bytes += name_lengths.capacity() * sizeof(uint32_t);
+        for (size_t i = 0; i < symbols.size(); i++) {
+            bytes += sizeof(string) + symbols[i].capacity();
+        }
+        return bytes;
+    }
+
+    // Saved as: the numbers of SNPs and symbols and the length of the saved
+    // name index, the columns, the n + 1 offsets of the symbols and the
+    // symbols, then the name index, as saved by name_index::save
+    void snp_table::save(string &out) const {
+        vector<uint64_t> header(3);
+        header[0] = size();
+        header[1] = symbols.size();
+        string index;
+        names.save(index);
+        header[2] = index.size();
+        append_array(out, header);
+
+        append_array(out, genetic);
+        append_array(out, physical);
+        append_array(out, chromosomes);
+        append_array(out, alleles_a);
+        append_array(out, alleles_b);
+        append_array(out, name_offsets);
+        append_array(out, name_lengths);
+
+        vector<uint64_t> offsets(symbols.size() + 1);
+        string text;
+        for (size_t i = 0; i < symbols.size(); i++) {
+            text.append(symbols[i]);
+            offsets[i + 1] = text.size();
+        }
+        append_array(out, offsets);
+        append_array(out, vector<char>(text.begin(), text.end()));
+
+        out.append(index);
+    }
+
+    bool snp_table::load(const char *data, size_t len) {
+        clear();
+
+        const char *p = data, *end = data + len;
+        vector<uint64_t> header, offsets;
+        vector<char> text;
+        bool ok = read_array(p, end, 3, header);
+        ok = ok && header[0] <= len && header[1] <= len;
+        size_t n = ok ? header[0] : 0;
+        ok = ok && read_array(p, end, n, genetic) &&
+            read_array(p, end, n, physical) &&
+            read_array(p, end, n, chromosomes) &&
+            read_array(p, end, n, alleles_a) &&
+            read_array(p, end, n, alleles_b) &&
+            read_array(p, end, n, name_offsets) &&
+            read_array(p, end, n, name_lengths) &&
+            read_array(p, end, header[1] + 1, offsets) &&
+            offsets[0] == 0 && offsets.back() <= len &&
+            read_array(p, end, offsets.back(), text) &&
+            header[2] == (uint64_t) (end - p) && names.load(p, header[2]);
+
+        for (size_t i = 0; ok && i < header[1]; i++) {
+            ok = offsets[i] <= offsets[i + 1] && offsets[i + 1] <= text.size();
+            if (ok) {
+                symbols.push_back(string(text.begin() + offsets[i],
+                                         text.begin() + offsets[i + 1]));
+                symbol_codes.insert(symbols.back(), i);
+            }
+        }
+        size_t arena = names.names().size();
+        for (size_t i = 0; ok && i < n; i++) {
+            ok = chromosomes[i] < symbols.size() &&
+                alleles_a[i] < symbols.size() &&
+                alleles_b[i] < symbols.size() &&
+                name_offsets[i] <= arena &&
+                name_lengths[i] <= arena - name_offsets[i];
+        }
+
+        if (!ok) {
+            clear();
+        }
+        return ok;
+    }
+}
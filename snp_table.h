@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GFTOOLS_SNP_TABLE_H
+#define GFTOOLS_SNP_TABLE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "name_index.h"
+#include "snp.h"
+
+namespace gftools {
+    /** A compact, column-oriented table of SNPs.
+     *
+     * Each field is held in its own array. Chromosome and allele names,
+     * which repeat heavily, are interned and stored as small codes, and
+     * SNP names are packed end to end in the arena of a name index, which
+     * both stores them and finds SNPs by name, so a table makes a handful
+     * of allocations however many SNPs it holds. SNPs are produced as
+     * gftools::snp on demand.
+     */
+    class snp_table {
+private:
+        std::vector<int> genetic;
+        std::vector<int> physical;
+        std::vector<uint32_t> chromosomes;
+        std::vector<uint32_t> alleles_a;
+        std::vector<uint32_t> alleles_b;
+
+        name_index names; // where names repeat, the last SNP wins
+        std::vector<size_t> name_offsets; // into names.names()
+        std::vector<uint32_t> name_lengths;
+
+        std::vector<std::string> symbols; // interned strings, by code
+        name_index symbol_codes;
+
+        uint32_t intern(const std::string &symbol);
+
+public:
+        /** Creates an empty table.
+         */
+        snp_table();
+
+        /** Creates a table holding a copy of some SNPs.
+         *
+         * @param snps The SNPs.
+         */
+        snp_table(const std::vector<snp> &snps);
+
+        /** Reserves space for a number of SNPs.
+         *
+         * @param snps The number of SNPs.
+         * @param name_bytes The total length of their names, if known.
+         */
+        void reserve(size_t snps, size_t name_bytes = 0);
+
+        /** Appends a SNP.
+         *
+         * @param snp The SNP.
+         */
+        void push_back(const snp &snp);
+
+        /** Removes all SNPs, releasing their memory.
+         */
+        void clear();
+
+        /** Returns the number of SNPs.
+         */
+        size_t size() const {
+            return genetic.size();
+        }
+
+        /** Returns true if there are no SNPs.
+         */
+        bool empty() const {
+            return genetic.empty();
+        }
+
+        /** Copies a SNP out of the table, reusing the storage of the
+         * destination's strings.
+         *
+         * @param i The index of the SNP.
+         * @param snp A SNP, overwritten.
+         */
+        void get(size_t i, snp &snp) const;
+
+        /** Returns a copy of a SNP.
+         *
+         * @param i The index of the SNP.
+         */
+        snp at(size_t i) const;
+
+        /** Returns the name of a SNP.
+         */
+        std::string name(size_t i) const {
+            return names.names().substr(name_offsets[i], name_lengths[i]);
+        }
+
+        /** Finds a SNP by name.
+         *
+         * @param name A SNP name.
+         * @return The index of the last SNP of that name, or -1 if there
+         * is none.
+         */
+        int find(const std::string &name) const {
+            return names.find(name);
+        }
+
+        /** Returns the chromosome of a SNP.
+         */
+        const std::string &chromosome(size_t i) const {
+            return symbols[chromosomes[i]];
+        }
+
+        /** Returns the interned symbol of the chromosome of a SNP, which is
+         * the same for SNPs with the same chromosome name. Unlike
+         * gftools::chromosome_code, it does not identify the chromosome.
+         */
+        uint32_t chromosome_symbol(size_t i) const {
+            return chromosomes[i];
+        }
+
+        /** Returns allele A of a SNP.
+         */
+        const std::string &allele_a(size_t i) const {
+            return symbols[alleles_a[i]];
+        }
+
+        /** Returns allele B of a SNP.
+         */
+        const std::string &allele_b(size_t i) const {
+            return symbols[alleles_b[i]];
+        }
+
+        /** Returns the genetic position of a SNP.
+         */
+        int genetic_position(size_t i) const {
+            return genetic[i];
+        }
+
+        /** Returns the physical position of a SNP.
+         */
+        int physical_position(size_t i) const {
+            return physical[i];
+        }
+
+        /** Returns the index of the SNP names, mapping each name to the
+         * index of its last SNP.
+         */
+        const name_index &name_lookup() const {
+            return names;
+        }
+
+        /** Returns the approximate number of bytes used by the table.
+         */
+        size_t memory_usage() const;
+
+        /** Appends the table to a block of bytes, in a layout that load
+         * can restore with a bulk copy of each column.
+         *
+         * @param out The block of bytes.
+         */
+        void save(std::string &out) const;
+
+        /** Replaces the table with one saved by save. Only the interned
+         * symbols are copied one by one, so loading makes a fixed number
+         * of allocations however many SNPs the table holds.
+         *
+         * @param data The saved bytes.
+         * @param len The number of saved bytes.
+         * @return false, leaving the table empty, if the bytes are not a
+         * consistent saved table.
+         */
+        bool load(const char *data, size_t len);
+    };
+}
+
+#endif // GFTOOLS_SNP_TABLE_H
@@ -0,0 +1,182 @@
+#include "plink_binary.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <set>
+#include <cstdlib>
+#include <getopt.h>
+
+
+/*
+ * Build a binary ped file from a subset of the SNPs of one or more others
+ * with the same individuals, copying the packed genotype calls of each
+ * SNP unchanged
+ */
+
+using namespace std;
+
+void usage(char *progname);
+
+struct region {
+    string chromosome;
+    int start;
+    int end;
+};
+
+region parse_region(const string &text);
+
+int main(int argc, char *argv[])
+{
+    const char* const short_options = "n:r:";
+    const struct option long_options[] = {
+        { "snp", 1, NULL, 'n' },
+        { "region", 1, NULL, 'r' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+
+    string snp_file;
+    vector<string> region_args;
+
+    do {
+        opt = getopt_long(argc, argv, short_options, long_options, NULL);
+        switch(opt) {
+            case 'n':
+                snp_file = optarg;
+                break;
+            case 'r':
+                region_args.push_back(optarg);
+                break;
+        }
+    } while (opt != -1);
+
+    if (argc - optind < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    plink_binary *out = new plink_binary();
+    vector<plink_binary *> inputs;
+    try {
+        set<string> names;
+        if (!snp_file.empty()) {
+            ifstream in(snp_file.c_str());
+            if (!in) {
+                throw gftools::malformed_data("Failed to open " + snp_file);
+            }
+            string s;
+            while (getline(in, s)) {
+                if (!s.empty()) {
+                    names.insert(s);
+                }
+            }
+        }
+        vector<region> regions;
+        for (unsigned int i = 0; i < region_args.size(); i++) {
+            regions.push_back(parse_region(region_args[i]));
+        }
+        bool select_all = snp_file.empty() && regions.empty();
+
+        // copy_snps checks that the individuals of each input match
+        for (int i = optind + 1; i < argc; i++) {
+            inputs.push_back(new plink_binary(argv[i]));
+        }
+
+        out->individuals = inputs[0]->individuals;
+        out->stream_bim = true;
+        out->open(argv[optind], 1);
+
+        set<string> found;
+        for (unsigned int i = 0; i < inputs.size(); i++) {
+            plink_binary &pb = *inputs[i];
+            int n_snps = pb.snp_count();
+
+            // Mark the selected SNPs, then copy them in runs, in BED order
+            vector<char> selected(n_snps, select_all);
+            for (set<string>::iterator it = names.begin(); it != names.end();
+                 ++it) {
+                int index = pb.find_snp(*it);
+                if (index != -1) {
+                    selected[index] = 1;
+                    found.insert(*it);
+                }
+            }
+            for (unsigned int j = 0; j < regions.size(); j++) {
+                vector<gftools::snp_range> ranges;
+                pb.find_region(regions[j].chromosome, regions[j].start,
+                               regions[j].end, ranges);
+                for (unsigned int k = 0; k < ranges.size(); k++) {
+                    for (int snp = ranges[k].first;
+                         snp < ranges[k].first + ranges[k].count; snp++) {
+                        selected[snp] = 1;
+                    }
+                }
+            }
+
+            int snp = 0;
+            while (snp < n_snps) {
+                if (!selected[snp]) {
+                    snp++;
+                    continue;
+                }
+                int first = snp;
+                while (snp < n_snps && selected[snp]) {
+                    snp++;
+                }
+                out->copy_snps(pb, first, snp - first);
+            }
+        }
+
+        for (set<string>::iterator it = names.begin(); it != names.end(); ++it) {
+            if (found.find(*it) == found.end()) {
+                cerr << "Warning: SNP " << *it << " not found" << endl;
+            }
+        }
+        out->close();
+    } catch (exception &e) {
+        cerr << "Error: " << e.what() << endl;
+        try {
+            out->abort();
+        } catch (exception &e) {
+            cerr << "Error: " << e.what() << endl;
+        }
+        return 1;
+    }
+    for (unsigned int i = 0; i < inputs.size(); i++) {
+        delete inputs[i];
+    }
+    delete out;
+}
+
+// Parses a region given as chromosome[:start-end]
+region parse_region(const string &text)
+{
+    region r;
+    size_t colon = text.find(':');
+    r.chromosome = text.substr(0, colon);
+    r.start = 0;
+    r.end = 2147483647;
+    if (colon != string::npos) {
+        istringstream in(text.substr(colon + 1));
+        char dash = 0;
+        if (!(in >> r.start >> dash >> r.end) || dash != '-' ||
+            !in.eof() || r.start > r.end) {
+            throw gftools::malformed_data("Invalid region " + text);
+        }
+    }
+    if (r.chromosome.empty()) {
+        throw gftools::malformed_data("Invalid region " + text);
+    }
+    return r;
+}
+
+void usage(char *progname)
+{
+    cout << "Usage: " << progname << " [options] OUTPUT INPUT [INPUT...]" << endl;
+    cout << "Copies the selected SNPs of each input, in turn, to the output." << endl;
+    cout << "The inputs must have the same individuals. Without a selection," << endl;
+    cout << "all their SNPs are copied." << endl;
+    cout << "Options: -snp         file of SNP names to copy" << endl;
+    cout << "         -region      region chr[:start-end] to copy (repeatable)" << endl;
+}
@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <sstream>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "genotype_codec.h"
+#include "genotype_encoder.h"
+#include "utilities.h"
+#include "tab_matrix.h"
+
+using std::string;
+using std::vector;
+
+// Read this many bytes of input per thread at a time, but no more than
+// MAX_BLOCK_BYTES in all, unless a line is longer
+const size_t BLOCK_BYTES = 16 << 20;
+const size_t MAX_BLOCK_BYTES = 64 << 20;
+
+namespace {
+    // A run of whole lines, parsed by one thread
+    struct row_chunk {
+        const char *begin;
+        const char *end;
+        char missing_genotype;
+        const string *chromosome;
+        size_t samples;
+
+        vector<gftools::snp> snps;
+        vector<unsigned char> packed;
+        string error;
+    };
+
+    // Finds the next field between p and end, skipping runs of tabs
+    bool next_field(const char *&p, const char *end,
+                    const char *&field, const char *&field_end) {
+        while (p < end && *p == '\t') {
+            p++;
+        }
+        if (p == end) {
+            return false;
+        }
+        field = p;
+        while (p < end && *p != '\t') {
+            p++;
+        }
+        field_end = p;
+        return true;
+    }
+
+    const char *line_end(const char *p, const char *end) {
+        const char *eol = (const char *) memchr(p, '\n', end - p);
+        return eol ? eol : end;
+    }
+
+    void encode_rows(row_chunk *chunk) {
+        gftools::genotype_encoder encoder(chunk->missing_genotype);
+        vector<uint8_t> calls(chunk->samples);
+        size_t bytes = (chunk->samples + 3) / 4;
+        gftools::snp snp;
+        snp.chromosome = *chunk->chromosome;
+
+        const char *p = chunk->begin;
+        while (p < chunk->end) {
+            const char *eol = line_end(p, chunk->end);
+            const char *q = eol;
+            if (q > p && q[-1] == '\r') {
+                q--;
+            }
+
+            const char *field, *field_end;
+            if (!next_field(p, q, field, field_end)) {
+                p = eol + 1; // blank line
+                continue;
+            }
+            snp.name.assign(field, field_end);
+            snp.allele_a.clear();
+            snp.allele_b.clear();
+            encoder.set_snp(snp);
+
+            size_t n = 0;
+            while (next_field(p, q, field, field_end)) {
+                if (field_end - field < 2) {
+                    string message = "Unrecognised genotype ";
+                    message.append(field, field_end - field);
+                    throw gftools::malformed_data(message);
+                }
+                if (n < calls.size()) {
+                    calls[n] = encoder.encode(field);
+                }
+                n++;
+            }
+            if (n == 0) {
+                throw gftools::malformed_data("No genotypes defined");
+            }
+            if (n != chunk->samples) {
+                std::stringstream ss;
+                ss << "Incorrect individual count: " << n;
+                ss << " genotypes for SNP " << snp.name;
+                ss << " whereas " << chunk->samples;
+                ss << " individuals defined.";
+                throw gftools::malformed_data(ss.str());
+            }
+
+            encoder.collated_alleles(snp);
+            chunk->snps.push_back(snp);
+            chunk->packed.resize(chunk->packed.size() + bytes);
+            gftools::pack_calls(&calls[0], calls.size(),
+                                &chunk->packed[chunk->packed.size() - bytes]);
+            p = eol + 1;
+        }
+    }
+
+    void *run_chunk(void *arg) {
+        row_chunk *chunk = (row_chunk *) arg;
+        try {
+            encode_rows(chunk);
+        }
+        catch (std::exception &e) {
+            chunk->error = e.what();
+            if (chunk->error.empty()) {
+                chunk->error = "Unknown error reading genotype matrix";
+            }
+        }
+        return NULL;
+    }
+}
+
+namespace gftools {
+
+    tab_matrix_reader::tab_matrix_reader(int fd, char missing_genotype,
+                                         const string &chromosome,
+                                         int threads)
+        : fd(fd), missing_genotype(missing_genotype), chromosome(chromosome),
+          threads(threads < 1 ? cpu_count() : threads),
+          buffer(BLOCK_BYTES), start(0), len(0), eof(false) {
+        const char *eol;
+        while (!(eol = (const char *) memchr(&buffer[0], '\n', len)) && !eof) {
+            fill();
+        }
+        if (len == 0) {
+            throw malformed_data("No header in genotype matrix");
+        }
+
+        const char *p = &buffer[0];
+        const char *end = eol ? eol : p + len;
+        if (end > p && end[-1] == '\r') {
+            end--;
+        }
+        const char *field, *field_end;
+        while (next_field(p, end, field, field_end)) {
+            names.push_back(string(field, field_end));
+        }
+        start = eol ? eol + 1 - &buffer[0] : len;
+    }
+
+    // Reads more input after any unparsed bytes, growing the buffer if it
+    // is full. Returns false at the end of the input.
+    bool tab_matrix_reader::fill() {
+        if (len == buffer.size()) {
+            buffer.resize(2 * buffer.size());
+        }
+
+        ssize_t n;
+        do {
+            n = read(fd, &buffer[len], buffer.size() - len);
+        } while (n == -1 && errno == EINTR);
+        if (n == -1) {
+            throw malformed_data("Failed to read genotype matrix: " +
+                                 error_message());
+        }
+        len += n;
+        eof = n == 0;
+        return !eof;
+    }
+
+    void tab_matrix_reader::write_rows(plink_binary &pb) {
+        size_t samples = names.size();
+        size_t block = std::max(buffer.size(),
+                                std::min(BLOCK_BYTES * threads,
+                                         MAX_BLOCK_BYTES));
+
+        while (true) {
+            // Read a block, keeping any partial line from the last one
+            if (start > 0) {
+                memmove(&buffer[0], &buffer[start], len - start);
+                len -= start;
+                start = 0;
+            }
+            if (buffer.size() < block) {
+                buffer.resize(block);
+            }
+            while (len < buffer.size() && fill()) {}
+
+            const char *text = &buffer[start];
+            const char *end = &buffer[len];
+            if (text == end) {
+                break;
+            }
+            // Leave a partial last line for the next block, unless it is
+            // the end of the input
+            if (!eof) {
+                while (end > text && end[-1] != '\n') {
+                    end--;
+                }
+                if (end == text) {
+                    block = 2 * buffer.size(); // a line longer than a block
+                    continue;
+                }
+            }
+
+            // Split after newlines, so that each chunk holds whole lines
+            size_t size = end - text;
+            vector<row_chunk> chunks(threads);
+            const char *p = text;
+            for (int i = 0; i < threads; i++) {
+                chunks[i].begin = p;
+                if (i == threads - 1) {
+                    p = end;
+                }
+                else {
+                    p = std::max(p, text + size / threads * (i + 1));
+                    p = p < end ? line_end(p, end) : end;
+                    p = p < end ? p + 1 : end;
+                }
+                chunks[i].end = p;
+                chunks[i].missing_genotype = missing_genotype;
+                chunks[i].chromosome = &chromosome;
+                chunks[i].samples = samples;
+            }
+
+            vector<pthread_t> ids(threads);
+            int started = 0;
+            for (int i = 1; i < threads; i++) {
+                if (pthread_create(&ids[i], NULL, run_chunk, &chunks[i])) {
+                    break;
+                }
+                started++;
+            }
+            run_chunk(&chunks[0]);
+            for (int i = 1; i <= started; i++) {
+                pthread_join(ids[i], NULL);
+            }
+            // Any chunks that could not be given a thread are parsed here
+            for (int i = started + 1; i < threads; i++) {
+                run_chunk(&chunks[i]);
+            }
+
+            // Write nothing of a block with a bad line
+            for (int i = 0; i < threads; i++) {
+                if (!chunks[i].error.empty()) {
+                    throw malformed_data(chunks[i].error);
+                }
+            }
+            size_t bytes = (samples + 3) / 4;
+            for (int i = 0; i < threads; i++) {
+                row_chunk &chunk = chunks[i];
+                for (size_t j = 0; j < chunk.snps.size(); j++) {
+                    packed_genotypes calls(&chunk.packed[j * bytes], samples);
+                    pb.write_snp(chunk.snps[j], calls);
+                }
+            }
+            start = end - &buffer[0];
+        }
+    }
+}
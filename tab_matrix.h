@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2012 Genome Research Ltd. All rights reserved.
+ *
+ * This file is part of Gftools.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GFTOOLS_TAB_MATRIX_H
+#define GFTOOLS_TAB_MATRIX_H
+
+#include <string>
+#include <vector>
+#include "plink_binary.h"
+
+namespace gftools {
+    /** Reads a tab-separated genotype matrix, as written by
+     * plink_binary_to_tab, and writes it to a dataset.
+     *
+     * The first line holds the names of the individuals. Each further line
+     * holds a SNP name followed by one two-character call per individual.
+     * Runs of tabs separate fields and a carriage return before a newline
+     * is ignored. The alleles of each SNP are collated from its calls.
+     *
+     * The input is read in blocks of up to 16 MiB per thread, and 64 MiB
+     * in all. Each block is split at line boundaries into chunks that are
+     * parsed and packed in parallel, then written to the dataset in order.
+     */
+    class tab_matrix_reader {
+private:
+        int fd;
+        char missing_genotype;
+        std::string chromosome;
+        int threads;
+        std::vector<char> buffer;
+        size_t start; // the first unparsed byte in buffer
+        size_t len;   // the number of bytes read into buffer
+        bool eof;
+        std::vector<std::string> names;
+
+        bool fill();
+
+        // Not copyable
+        tab_matrix_reader(const tab_matrix_reader &other);
+        tab_matrix_reader &operator=(const tab_matrix_reader &other);
+
+public:
+        /** Starts reading a matrix, by reading its header.
+         *
+         * @param fd A file descriptor open for reading, e.g. of stdin.
+         * @param missing_genotype The character of each allele of a
+         * no-call.
+         * @param chromosome The chromosome of every SNP.
+         * @param threads The number of threads, or 0 to use one per online
+         * CPU.
+         */
+        tab_matrix_reader(int fd, char missing_genotype,
+                          const std::string &chromosome, int threads = 0);
+
+        /** Returns the names of the individuals, from the header.
+         */
+        const std::vector<std::string> &sample_names() const {
+            return names;
+        }
+
+        /** Reads the remaining lines and writes their SNPs to a dataset.
+         * Throws malformed_data if a line cannot be read. No SNP of the
+         * block holding that line is written, but those of earlier blocks
+         * already have been; plink_binary::abort undoes them.
+         *
+         * @param pb A dataset open for writing, with one individual per
+         * name in the header.
+         */
+        void write_rows(plink_binary &pb);
+    };
+}
+
+#endif // GFTOOLS_TAB_MATRIX_H
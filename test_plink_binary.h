@@ -21,12 +21,24 @@
 #define TEST_PLINK_BINARY_H
 
 #include <cstdio>
+#include <cstring>
 #include <map>
 #include <fstream>
 #include <sstream>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <cxxtest/TestSuite.h>
+#include "genotype_codec.h"
+#include "genotype_formatter.h"
 #include "plink_binary.h"
+#include "plink_text.h"
+#include "sidecar.h"
+#include "output_stage.h"
+#include "snp_prefetcher.h"
+#include "snp_scan.h"
+#include "tab_matrix.h"
 
 using std::ifstream;
 using std::string;
@@ -35,6 +47,101 @@ using std::vector;
 using gftools::individual;
 using gftools::snp;
 
+// Reads every SNP of a dataset repeatedly, counting unexpected calls
+struct read_job {
+    const plink_binary *pb;
+    const uint8_t (*expected)[4];
+    int errors;
+};
+
+static void *read_repeatedly(void *arg) {
+    read_job *job = (read_job *) arg;
+    vector<uint8_t> calls;
+    vector<unsigned char> buffer;
+    job->errors = 0;
+
+    for (int n = 0; n < 500; n++) {
+        for (int i = 0; i < 4; i++) {
+            job->pb->read_snp(i, calls);
+            gftools::packed_genotypes view = job->pb->view_snp(i, buffer);
+            for (int j = 0; j < 4; j++) {
+                if (calls[j] != job->expected[i][j] ||
+                    view.call(j) != job->expected[i][j]) {
+                    job->errors++;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+// Writes the SNPs of a presized dataset whose indices have a given remainder
+struct write_job {
+    plink_binary *pb;
+    int remainder;
+    int errors;
+};
+
+static void *write_slots(void *arg) {
+    write_job *job = (write_job *) arg;
+    for (int i = 5; i >= 0; i--) {
+        if (i % 2 == job->remainder) {
+            snp snp;
+            snp.name = "rs" + string(1, 'a' + i);
+            snp.allele_a = "A";
+            snp.allele_b = "G";
+            vector<uint8_t> calls(4, i % 4);
+            try {
+                job->pb->write_snp_at(i, snp, calls);
+            }
+            catch (std::exception &e) {
+                job->errors++;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Copies the files of a dataset
+static void copy_dataset(const string &from, const string &to) {
+    const char *suffixes[] = { ".bed", ".bim", ".fam" };
+    for (int i = 0; i < 3; i++) {
+        ifstream in((from + suffixes[i]).c_str(), std::ios::binary);
+        std::ofstream out((to + suffixes[i]).c_str(), std::ios::binary);
+        out << in.rdbuf();
+    }
+}
+
+// Sums the call codes of each SNP, and counts the blocks processed
+class call_sum : public gftools::snp_scan_task {
+public:
+    vector<int> sums;
+    int blocks;
+
+    call_sum(size_t snps) : sums(snps), blocks(0) {}
+
+    gftools::snp_scan_task *clone() const {
+        return new call_sum(sums.size());
+    }
+
+    void process(const gftools::snp_block &block) {
+        blocks++;
+        for (int i = 0; i < block.count; i++) {
+            for (size_t j = 0; j < block.samples; j++) {
+                sums[block.first + i] += block.calls[i * block.samples + j];
+            }
+        }
+    }
+
+    void reduce(const gftools::snp_scan_task &other) {
+        const call_sum &o = dynamic_cast<const call_sum &>(other);
+        blocks += o.blocks;
+        for (size_t i = 0; i < sums.size(); i++) {
+            sums[i] += o.sums[i];
+        }
+    }
+};
+
 class ReadTest : public CxxTest::TestSuite {
 
     vector<string> expected_a;
@@ -110,6 +217,637 @@ public:
         pb.close();
     }
 
+    void test_block_read() {
+        for (int direct = 0; direct < 2; direct++) {
+            plink_binary pb = plink_binary();
+            pb.quell_mem_mapping = true;
+            pb.direct_io = direct;
+            pb.open("data");
+            pb.missing_genotype = '0';
+
+            vector<string> genotypes;
+            snp snp;
+            for (int i = 0; i < 4; i++) {
+                TS_ASSERT(pb.next_snp(snp, genotypes));
+                TS_ASSERT_EQUALS(expected_snp[i], snp.name);
+                TS_ASSERT_EQUALS(expected_gen[snp.name], genotypes);
+            }
+            TS_ASSERT(!pb.next_snp(snp, genotypes));
+
+            pb.read_snp("rs1001", genotypes);
+            TS_ASSERT_EQUALS(expected_gen["rs1001"], genotypes);
+            TS_ASSERT_EQUALS(2, pb.view_snp(2).call(0));
+            TS_ASSERT_EQUALS(3, pb.view_snps(1, 3)[2].call(1));
+            pb.close();
+        }
+    }
+
+    void test_view_snp() {
+        plink_binary pb = plink_binary("data");
+        int expected[4][4] = {{0, 0, 0, 0},
+                              {1, 1, 1, 1},
+                              {2, 3, 2, 3},
+                              {3, 3, 2, 3}};
+
+        for (int i = 0; i < 4; i++) {
+            gftools::packed_genotypes view = pb.view_snp(i);
+            TS_ASSERT_EQUALS(4, view.samples);
+            TS_ASSERT_EQUALS(1, view.bytes());
+            for (int j = 0; j < 4; j++) {
+                TS_ASSERT_EQUALS(expected[i][j], view.call(j));
+            }
+        }
+
+        size_t counts[4];
+        pb.view_snp(2).count_calls(counts);
+        TS_ASSERT_EQUALS(0, counts[0]);
+        TS_ASSERT_EQUALS(0, counts[1]);
+        TS_ASSERT_EQUALS(2, counts[2]);
+        TS_ASSERT_EQUALS(2, counts[3]);
+
+        gftools::packed_snps block = pb.view_snps(1, 3);
+        TS_ASSERT_EQUALS(3, block.snps);
+        TS_ASSERT_EQUALS(1, block.bytes_per_snp());
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                TS_ASSERT_EQUALS(expected[i + 1][j], block[i].call(j));
+            }
+        }
+
+        TS_ASSERT_THROWS_ANYTHING(pb.view_snp(4));
+        TS_ASSERT_THROWS_ANYTHING(pb.view_snps(2, 3));
+        pb.close();
+    }
+
+    void test_read_snps() {
+        plink_binary pb = plink_binary("data");
+        uint8_t expected[4][4] = {{0, 0, 0, 0},
+                                  {1, 1, 1, 1},
+                                  {2, 3, 2, 3},
+                                  {3, 3, 2, 3}};
+
+        vector<uint8_t> matrix;
+        pb.read_snps(1, 3, matrix);
+        TS_ASSERT_EQUALS(12, matrix.size());
+        for (int j = 0; j < 3; j++) {
+            for (int i = 0; i < 4; i++) {
+                TS_ASSERT_EQUALS(expected[j + 1][i], matrix[j * 4 + i]);
+            }
+        }
+
+        pb.read_snps(0, 4, matrix, true);
+        TS_ASSERT_EQUALS(16, matrix.size());
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++) {
+                TS_ASSERT_EQUALS(expected[j][i], matrix[i * 4 + j]);
+            }
+        }
+
+        pb.read_snps(4, 0, matrix);
+        TS_ASSERT(matrix.empty());
+        TS_ASSERT_THROWS_ANYTHING(pb.read_snps(3, 2, matrix));
+        pb.close();
+    }
+
+    void test_concurrent_read() {
+        const uint8_t expected[4][4] = {{0, 0, 0, 0},
+                                        {1, 1, 1, 1},
+                                        {2, 3, 2, 3},
+                                        {3, 3, 2, 3}};
+        const int n_threads = 4;
+
+        for (int mapped = 0; mapped < 2; mapped++) {
+            plink_binary pb = plink_binary();
+            pb.quell_mem_mapping = !mapped;
+            pb.open("data");
+
+            pthread_t threads[n_threads];
+            read_job jobs[n_threads];
+            for (int i = 0; i < n_threads; i++) {
+                jobs[i].pb = &pb;
+                jobs[i].expected = expected;
+                TS_ASSERT_EQUALS(0, pthread_create(&threads[i], NULL,
+                                                   read_repeatedly, &jobs[i]));
+            }
+            for (int i = 0; i < n_threads; i++) {
+                pthread_join(threads[i], NULL);
+                TS_ASSERT_EQUALS(0, jobs[i].errors);
+            }
+
+            vector<uint8_t> matrix;
+            pb.read_snps(0, 4, matrix);
+            for (int i = 0; i < 4; i++) {
+                for (int j = 0; j < 4; j++) {
+                    TS_ASSERT_EQUALS(expected[i][j], matrix[i * 4 + j]);
+                }
+            }
+            pb.close();
+        }
+    }
+
+    void test_parallel_scan() {
+        plink_binary pb = plink_binary("data");
+        int expected[4] = {0, 4, 10, 11};
+
+        for (int threads = 1; threads <= 4; threads++) {
+            call_sum task(pb.snps.size());
+            gftools::parallel_scan(pb, task, 0, 4, threads, 1);
+            TS_ASSERT_EQUALS(4, task.blocks);
+            for (int i = 0; i < 4; i++) {
+                TS_ASSERT_EQUALS(expected[i], task.sums[i]);
+            }
+        }
+
+        call_sum task(pb.snps.size());
+        gftools::parallel_scan(pb, task, 0);
+        for (int i = 0; i < 4; i++) {
+            TS_ASSERT_EQUALS(expected[i], task.sums[i]);
+        }
+        TS_ASSERT_THROWS(gftools::parallel_scan(pb, task, 2, 3, 2, 1),
+                         gftools::malformed_data);
+
+        // Only the kept individuals are decoded
+        vector<int> keep;
+        keep.push_back(1);
+        keep.push_back(3);
+        pb.keep_samples(keep);
+        int kept[4] = {0, 2, 6, 6};
+        call_sum subset(pb.snps.size());
+        gftools::parallel_scan(pb, subset, 0, 4, 2, 1);
+        for (int i = 0; i < 4; i++) {
+            TS_ASSERT_EQUALS(kept[i], subset.sums[i]);
+        }
+        pb.close();
+    }
+
+    void test_genotype_formatter() {
+        snp snp;
+        snp.allele_a = "A";
+        snp.allele_b = "G";
+        uint8_t codes[] = {1, 2, 0, 3};
+
+        gftools::genotype_formatter tped(" ", " ", 'N');
+        tped.set_snp(snp);
+        vector<char> buffer(tped.buffer_size(4));
+        size_t n = tped.format(codes, 4, &buffer[0]);
+        TS_ASSERT_EQUALS(" A A A G N N G G", string(&buffer[0], n));
+
+        // Long alleles take the general path
+        snp.allele_b = "AGGTCAGT";
+        gftools::genotype_formatter tab;
+        tab.set_snp(snp);
+        vector<char> line(1, 'x');
+        tab.append(vector<uint8_t>(codes, codes + 4), line);
+        TS_ASSERT_EQUALS("x\tAA\tAAGGTCAGT\t00\tAGGTCAGTAGGTCAGT",
+                         string(line.begin(), line.end()));
+    }
+
+    void test_snp_prefetcher() {
+        for (int mapped = 0; mapped < 2; mapped++) {
+            plink_binary pb = plink_binary();
+            pb.quell_mem_mapping = !mapped;
+            pb.open("data");
+            pb.missing_genotype = '0';
+
+            for (int depth = 1; depth <= 5; depth += 2) {
+                gftools::snp_prefetcher reader(pb, depth);
+                snp snp;
+                vector<string> genotypes;
+                int n = 0;
+                while (reader.next_snp(snp, genotypes)) {
+                    TS_ASSERT_EQUALS(expected_snp[n], snp.name);
+                    TS_ASSERT_EQUALS(expected_gen[snp.name], genotypes);
+                    n++;
+                }
+                TS_ASSERT_EQUALS(4, n);
+                TS_ASSERT(!reader.next_snp(snp, genotypes));
+            }
+
+            gftools::snp_prefetcher reader(pb, 2, 1);
+            snp snp;
+            vector<uint8_t> calls;
+            TS_ASSERT(reader.next_snp(snp, calls));
+            TS_ASSERT_EQUALS("rs1002", snp.name);
+            TS_ASSERT_EQUALS(2, calls[0]);
+            TS_ASSERT_EQUALS(3, calls[1]);
+            TS_ASSERT(!reader.next_snp(snp, calls));
+
+            // Stopping early
+            gftools::snp_prefetcher partial(pb, 1);
+            TS_ASSERT(partial.next_snp(snp, calls));
+            partial.close();
+            TS_ASSERT(!partial.next_snp(snp, calls));
+            pb.close();
+        }
+    }
+
+    void test_keep_samples() {
+        plink_binary pb = plink_binary("data");
+        pb.missing_genotype = '0';
+
+        int keep[] = {3, 1};
+        pb.keep_samples(vector<int>(keep, keep + 2));
+        TS_ASSERT_EQUALS(2, pb.call_count());
+
+        vector<string> genotypes;
+        pb.read_snp("rs1002", genotypes);
+        TS_ASSERT_EQUALS(2, genotypes.size());
+        TS_ASSERT_EQUALS("CC", genotypes[0]);
+        TS_ASSERT_EQUALS("CC", genotypes[1]);
+
+        vector<uint8_t> calls;
+        pb.read_snp(3, calls);
+        TS_ASSERT_EQUALS(2, calls.size());
+        TS_ASSERT_EQUALS(3, calls[0]);
+        TS_ASSERT_EQUALS(3, calls[1]);
+
+        vector<string> names;
+        names.push_back("sample_000");
+        names.push_back("sample_002");
+        pb.keep_samples(names);
+        vector<uint8_t> matrix;
+        pb.read_snps(2, 2, matrix, true);
+        TS_ASSERT_EQUALS(4, matrix.size());
+        TS_ASSERT_EQUALS(2, matrix[0]);
+        TS_ASSERT_EQUALS(3, matrix[1]);
+        TS_ASSERT_EQUALS(2, matrix[2]);
+        TS_ASSERT_EQUALS(2, matrix[3]);
+
+        names.push_back("no_such_sample");
+        TS_ASSERT_THROWS(pb.keep_samples(names), gftools::malformed_data);
+        TS_ASSERT_THROWS(pb.keep_samples(vector<int>(1, 4)),
+                         gftools::malformed_data);
+        size_t kept = pb.call_count();
+        TS_ASSERT_THROWS(pb.keep_samples(vector<int>()),
+                         gftools::malformed_data);
+        TS_ASSERT_THROWS(pb.keep_samples(vector<string>()),
+                         gftools::malformed_data);
+        TS_ASSERT_EQUALS(kept, pb.call_count());
+
+        pb.keep_all_samples();
+        pb.read_snp(3, calls);
+        TS_ASSERT_EQUALS(4, calls.size());
+        pb.close();
+
+        plink_binary unmapped = plink_binary();
+        unmapped.quell_mem_mapping = true;
+        unmapped.open("data");
+        unmapped.keep_samples(vector<int>(keep, keep + 2));
+        unmapped.read_snp(2, calls);
+        TS_ASSERT_EQUALS(2, calls.size());
+        TS_ASSERT_EQUALS(3, calls[0]);
+        TS_ASSERT_EQUALS(3, calls[1]);
+        unmapped.close();
+    }
+
+    void test_parse_bim() {
+        string text = "1 rs1 0.5 100 A G\r\n"
+            "\n"
+            "X\trs2\t0\t-7\n"
+            "MT rs3 0 2147483647 C T";
+
+        for (int threads = 1; threads <= 3; threads++) {
+            vector<snp> snps;
+            gftools::parse_bim(text.data(), text.size(), snps, threads);
+            TS_ASSERT_EQUALS(4, snps.size());
+            TS_ASSERT_EQUALS("1", snps[0].chromosome);
+            TS_ASSERT_EQUALS("rs1", snps[0].name);
+            TS_ASSERT_EQUALS(0, snps[0].genetic_position);
+            TS_ASSERT_EQUALS(100, snps[0].physical_position);
+            TS_ASSERT_EQUALS("G", snps[0].allele_b);
+            TS_ASSERT_EQUALS("", snps[1].name);
+            TS_ASSERT_EQUALS(-7, snps[2].physical_position);
+            TS_ASSERT_EQUALS("", snps[2].allele_a);
+            TS_ASSERT_EQUALS(2147483647, snps[3].physical_position);
+            TS_ASSERT_EQUALS("T", snps[3].allele_b);
+        }
+
+        vector<individual> individuals;
+        text = "fam1 ind1 0 0 1 -9\nfam2 ind2";
+        gftools::parse_fam(text.data(), text.size(), individuals);
+        TS_ASSERT_EQUALS(2, individuals.size());
+        TS_ASSERT_EQUALS("ind1", individuals[0].name);
+        TS_ASSERT_EQUALS("-9", individuals[0].phenotype);
+        TS_ASSERT_EQUALS("ind2", individuals[1].name);
+        TS_ASSERT_EQUALS("", individuals[1].father);
+    }
+
+    void test_snp_index() {
+        plink_binary pb = plink_binary("data");
+        TS_ASSERT_EQUALS(4, pb.snp_index.size());
+        for (int i = 0; i < 4; i++) {
+            TS_ASSERT_EQUALS(i, pb.snp_index.find(expected_snp[i]));
+        }
+        TS_ASSERT_EQUALS(-1, pb.snp_index.find("rs9999"));
+        TS_ASSERT_EQUALS(4, pb.snp_index.size());
+
+        vector<string> genotypes;
+        TS_ASSERT_THROWS(pb.read_snp("rs9999", genotypes),
+                         gftools::malformed_data);
+        pb.close();
+        TS_ASSERT(pb.snp_index.empty());
+
+        // Enough names to grow the table several times
+        gftools::name_index index;
+        for (int i = 0; i < 1000; i++) {
+            std::stringstream ss;
+            ss << "rs" << i;
+            index.insert(ss.str(), i);
+        }
+        index.insert("rs10", 42);
+        TS_ASSERT_EQUALS(1000, index.size());
+        TS_ASSERT_EQUALS(42, index.find("rs10"));
+        TS_ASSERT_EQUALS(999, index.find("rs999"));
+        TS_ASSERT_EQUALS(-1, index.find("rs1000"));
+        TS_ASSERT_EQUALS(-1, index.find(""));
+    }
+
+    void test_compact_snps() {
+        plink_binary pb = plink_binary();
+        pb.compact_snps = true;
+        pb.open("data");
+        pb.missing_genotype = '0';
+
+        TS_ASSERT(pb.snps.empty());
+        TS_ASSERT_EQUALS(4, pb.snp_count());
+        TS_ASSERT_EQUALS("rs1002", pb.snp_columns.name(2));
+        TS_ASSERT_EQUALS(pb.snp_columns.chromosome_symbol(0),
+                         pb.snp_columns.chromosome_symbol(3));
+        TS_ASSERT(pb.snp_index.empty());
+        TS_ASSERT_EQUALS(2, pb.find_snp("rs1002"));
+        TS_ASSERT_EQUALS(-1, pb.find_snp("rs9999"));
+
+        vector<string> genotypes;
+        snp snp;
+        for (int i = 0; i < 4; i++) {
+            TS_ASSERT(pb.next_snp(snp, genotypes));
+            TS_ASSERT_EQUALS(expected_snp[i], snp.name);
+            TS_ASSERT_EQUALS(expected_a[i], snp.allele_a);
+            TS_ASSERT_EQUALS(expected_b[i], snp.allele_b);
+            TS_ASSERT_EQUALS(i + 1, snp.physical_position);
+            TS_ASSERT_EQUALS(expected_gen[snp.name], genotypes);
+        }
+        TS_ASSERT(!pb.next_snp(snp, genotypes));
+
+        pb.read_snp("rs1003", genotypes);
+        TS_ASSERT_EQUALS(expected_gen["rs1003"], genotypes);
+
+        vector<gftools::snp_range> ranges;
+        pb.find_region("2", 2, 4, ranges);
+        TS_ASSERT_EQUALS(1, ranges.size());
+        TS_ASSERT_EQUALS(1, ranges[0].first);
+        TS_ASSERT_EQUALS(3, ranges[0].count);
+        pb.close();
+        TS_ASSERT(pb.snp_columns.empty());
+
+        // A repeated name is stored once, and found as its last SNP
+        vector<gftools::snp> snps(3);
+        snps[0].name = "rs1";
+        snps[1].name = "rs2";
+        snps[2].name = "rs1";
+        gftools::snp_table table(snps);
+        TS_ASSERT_EQUALS("rs1", table.name(2));
+        TS_ASSERT_EQUALS("rs2", table.at(1).name);
+        TS_ASSERT_EQUALS(2, table.find("rs1"));
+        TS_ASSERT_EQUALS(-1, table.find("rs3"));
+    }
+
+    void test_chromosome_codes() {
+        TS_ASSERT_EQUALS(2, gftools::chromosome_code("2"));
+        TS_ASSERT_EQUALS(gftools::CHROMOSOME_X, gftools::chromosome_code("chrX"));
+        TS_ASSERT_EQUALS(gftools::CHROMOSOME_X, gftools::chromosome_code("23"));
+        TS_ASSERT_EQUALS(gftools::CHROMOSOME_MT, gftools::chromosome_code("M"));
+        TS_ASSERT_EQUALS(gftools::CHROMOSOME_XY, gftools::chromosome_code("xy"));
+        TS_ASSERT_EQUALS(0, gftools::chromosome_code("27"));
+        TS_ASSERT_EQUALS(0, gftools::chromosome_code("Un"));
+        TS_ASSERT_EQUALS("MT", gftools::chromosome_name(26));
+        TS_ASSERT_EQUALS(gftools::UNPLACED, gftools::chromosome_class(0));
+
+        plink_binary pb = plink_binary("data");
+        TS_ASSERT_EQUALS(4, pb.chromosome_codes.size());
+        TS_ASSERT_EQUALS(2, pb.chromosome_codes[3]);
+        TS_ASSERT_EQUALS(gftools::AUTOSOMAL, pb.snp_class(0));
+        TS_ASSERT_EQUALS(1, pb.chromosome_ranges(2).size());
+        TS_ASSERT_EQUALS(0, pb.chromosome_ranges(2)[0].first);
+        TS_ASSERT_EQUALS(4, pb.chromosome_ranges(2)[0].count);
+        TS_ASSERT(pb.chromosome_ranges(gftools::CHROMOSOME_X).empty());
+        pb.close();
+    }
+
+    void test_find_region() {
+        plink_binary pb = plink_binary("data");
+        vector<gftools::snp_range> ranges;
+
+        pb.find_region("2", 2, 3, ranges);
+        TS_ASSERT_EQUALS(1, ranges.size());
+        TS_ASSERT_EQUALS(1, ranges[0].first);
+        TS_ASSERT_EQUALS(2, ranges[0].count);
+
+        pb.find_region("2", 5, 9, ranges);
+        TS_ASSERT(ranges.empty());
+        pb.find_region("X", 0, 9, ranges);
+        TS_ASSERT(ranges.empty());
+        pb.close();
+
+        // Unsorted positions give several runs, in BED order
+        int positions[] = {5, 1, 3, 2};
+        vector<snp> snps;
+        for (int i = 0; i < 4; i++) {
+            snp s;
+            s.chromosome = "1";
+            s.physical_position = positions[i];
+            snps.push_back(s);
+        }
+        snps[1].chromosome = "2";
+
+        gftools::region_index index(snps);
+        index.find("1", 2, 5, ranges);
+        TS_ASSERT_EQUALS(2, ranges.size());
+        TS_ASSERT_EQUALS(0, ranges[0].first);
+        TS_ASSERT_EQUALS(1, ranges[0].count);
+        TS_ASSERT_EQUALS(2, ranges[1].first);
+        TS_ASSERT_EQUALS(2, ranges[1].count);
+
+        index.find("2", ranges);
+        TS_ASSERT_EQUALS(1, ranges.size());
+        TS_ASSERT_EQUALS(1, ranges[0].first);
+
+        // Chromosomes are matched by code, other names exactly
+        snps[0].chromosome = "chrX";
+        snps[2].chromosome = "23";
+        snps[3].chromosome = "GL000192.1";
+        index = gftools::region_index(snps);
+        index.find("X", ranges);
+        TS_ASSERT_EQUALS(2, ranges.size());
+        index.find("chr2", ranges);
+        TS_ASSERT_EQUALS(1, ranges.size());
+        index.find("GL000192.1", ranges);
+        TS_ASSERT_EQUALS(1, ranges.size());
+        TS_ASSERT_EQUALS(3, ranges[0].first);
+        index.find("0", ranges);
+        TS_ASSERT(ranges.empty());
+    }
+
+    void test_sample_subset() {
+        // Sorted subsets may be gathered by bit extraction, others by
+        // table; both must agree with decoding everything
+        const size_t n = 1001;
+        vector<unsigned char> packed((n + 3) / 4);
+        unsigned int x = 7;
+        for (size_t i = 0; i < packed.size(); i++) {
+            x = x * 1103515245 + 12345;
+            packed[i] = x >> 16;
+        }
+        vector<uint8_t> all(n);
+        gftools::unpack_calls(&packed[0], n, &all[0]);
+
+        for (int step = 1; step < 40; step += 3) {
+            vector<int> sorted, reversed;
+            for (size_t i = step / 2; i < n; i += step) {
+                sorted.push_back(i);
+            }
+            reversed.assign(sorted.rbegin(), sorted.rend());
+
+            gftools::sample_subset forward(sorted, n);
+            gftools::sample_subset backward(reversed, n);
+            vector<uint8_t> calls(sorted.size());
+            vector<int> int_calls(sorted.size());
+
+            forward.extract(&packed[0], &calls[0]);
+            backward.extract(&packed[0], &int_calls[0]);
+            for (size_t i = 0; i < sorted.size(); i++) {
+                TS_ASSERT_EQUALS(all[sorted[i]], calls[i]);
+                TS_ASSERT_EQUALS(all[reversed[i]], int_calls[i]);
+            }
+        }
+    }
+
+    void test_uint8_genotypes() {
+        plink_binary pb = plink_binary("data");
+        pb.missing_genotype = '0';
+
+        vector<int> int_calls;
+        vector<uint8_t> calls;
+        for (int i = 0; i < 4; i++) {
+            pb.read_snp(i, int_calls);
+            pb.read_snp(i, calls);
+            TS_ASSERT_EQUALS(4, calls.size());
+            for (int j = 0; j < 4; j++) {
+                TS_ASSERT_EQUALS(int_calls[j], calls[j]);
+            }
+        }
+
+        snp snp;
+        vector<string> genotypes;
+        TS_ASSERT(pb.next_snp(snp, calls));
+        TS_ASSERT(pb.next_snp(snp, calls));
+        TS_ASSERT(pb.next_snp(snp, calls));
+        pb.genotypes_itoa(snp, calls, genotypes);
+        TS_ASSERT_EQUALS(4, genotypes.size());
+        for (int j = 0; j < 4; j++) {
+            TS_ASSERT_EQUALS(expected_gen[snp.name][j], genotypes[j]);
+        }
+
+        vector<uint8_t> encoded;
+        pb.genotypes_atoi(snp, genotypes, encoded);
+        TS_ASSERT(encoded == calls);
+
+        calls[0] = 4;
+        TS_ASSERT_THROWS_ANYTHING(pb.genotypes_itoa(snp, calls, genotypes));
+        pb.close();
+    }
+
+    void test_unpack_calls() {
+        // Pseudo-random packed data, including padding bits
+        vector<unsigned char> packed(256);
+        unsigned int x = 12345;
+        for (unsigned int i = 0; i < packed.size(); i++) {
+            x = x * 1103515245 + 12345;
+            packed[i] = (x >> 16) & 0xff;
+        }
+
+        size_t sizes[] = {0, 1, 3, 4, 5, 63, 64, 65, 127, 128, 129, 1000, 1024};
+        for (unsigned int s = 0; s < sizeof(sizes) / sizeof(size_t); s++) {
+            size_t n = sizes[s];
+            vector<uint8_t> expected(n + 1, 99);
+            gftools::unpack_calls_scalar(&packed[0], n, &expected[0]);
+
+            vector<uint8_t> calls(n + 1, 99);
+            gftools::unpack_calls_table(&packed[0], n, &calls[0]);
+            TS_ASSERT(calls == expected);
+
+            if (gftools::has_ssse3()) {
+                calls.assign(n + 1, 99);
+                gftools::unpack_calls_ssse3(&packed[0], n, &calls[0]);
+                TS_ASSERT(calls == expected);
+            }
+            if (gftools::has_avx2()) {
+                calls.assign(n + 1, 99);
+                gftools::unpack_calls_avx2(&packed[0], n, &calls[0]);
+                TS_ASSERT(calls == expected);
+            }
+
+            calls.assign(n + 1, 99);
+            gftools::unpack_calls(&packed[0], n, &calls[0]);
+            TS_ASSERT(calls == expected);
+
+            vector<int> int_calls(n + 1, 99);
+            gftools::unpack_calls(&packed[0], n, &int_calls[0]);
+            for (unsigned int i = 0; i <= n; i++) {
+                TS_ASSERT_EQUALS(expected[i], int_calls[i]);
+            }
+        }
+    }
+
+    void test_pack_calls() {
+        // Pseudo-random calls, including some out of range codes
+        vector<uint8_t> calls(1024);
+        unsigned int x = 54321;
+        for (unsigned int i = 0; i < calls.size(); i++) {
+            x = x * 1103515245 + 12345;
+            calls[i] = (x >> 16) % 5;
+        }
+        calls[0] = 4;
+
+        size_t sizes[] = {0, 1, 3, 4, 5, 63, 64, 65, 127, 128, 129, 1000, 1024};
+        for (unsigned int s = 0; s < sizeof(sizes) / sizeof(size_t); s++) {
+            size_t n = sizes[s];
+            size_t len = (n + 3) / 4;
+            vector<unsigned char> expected(len + 1, 0xaa);
+            gftools::pack_calls_scalar(&calls[0], n, &expected[0]);
+
+            vector<unsigned char> packed(len + 1, 0xaa);
+            if (gftools::has_ssse3()) {
+                gftools::pack_calls_ssse3(&calls[0], n, &packed[0]);
+                TS_ASSERT(packed == expected);
+            }
+            if (gftools::has_avx2()) {
+                packed.assign(len + 1, 0xaa);
+                gftools::pack_calls_avx2(&calls[0], n, &packed[0]);
+                TS_ASSERT(packed == expected);
+            }
+
+            packed.assign(len + 1, 0xaa);
+            gftools::pack_calls(&calls[0], n, &packed[0]);
+            TS_ASSERT(packed == expected);
+
+            vector<int> int_calls(calls.begin(), calls.begin() + n);
+            if (n) {
+                int_calls[0] = -1; // as calls[0], a no call
+            }
+            packed.assign(len + 1, 0xaa);
+            gftools::pack_calls(&int_calls[0], n, &packed[0]);
+            TS_ASSERT(packed == expected);
+
+            // Round trip, with out of range codes becoming no calls
+            vector<uint8_t> unpacked(n + 1);
+            gftools::unpack_calls(&expected[0], n, &unpacked[0]);
+            for (unsigned int i = 0; i < n; i++) {
+                TS_ASSERT_EQUALS(calls[i] > 3 ? 0 : calls[i], unpacked[i]);
+            }
+        }
+    }
+
     void test_open_empty() {
         // All these Plink files are present, but empty
         plink_binary pb = plink_binary();
@@ -195,6 +933,436 @@ public:
         }
     }
 
+    void test_open_append() {
+        char *tmpname = tmpnam(NULL);
+        if (!tmpname) {
+            TS_FAIL("Failed to create a temporary file name");
+            return;
+        }
+        string tmpfile = string(tmpname);
+        copy_dataset("data", tmpfile);
+
+        plink_binary pb = plink_binary();
+        pb.open_append(tmpfile);
+        TS_ASSERT_EQUALS(4, pb.individuals.size());
+        snp snp;
+        snp.chromosome = "3";
+        snp.allele_a = "G";
+        snp.allele_b = "T";
+        for (int i = 0; i < 2; i++) {
+            snp.name = "rs200" + string(1, '0' + i);
+            vector<uint8_t> calls(4, i + 1);
+            pb.write_snp(snp, calls);
+        }
+        TS_ASSERT_EQUALS(2, pb.snp_count());
+        pb.close();
+
+        pb.open(tmpfile);
+        pb.missing_genotype = '0';
+        TS_ASSERT_EQUALS(6, pb.snps.size());
+        TS_ASSERT_EQUALS(4, pb.individuals.size());
+        vector<string> genotypes;
+        pb.read_snp("rs1003", genotypes);
+        TS_ASSERT_EQUALS(expected_gen["rs1003"], genotypes);
+        TS_ASSERT_EQUALS("rs2001", pb.snps[5].name);
+        TS_ASSERT_EQUALS("T", pb.snps[5].allele_b);
+        vector<uint8_t> calls;
+        pb.read_snp(5, calls);
+        TS_ASSERT(calls == vector<uint8_t>(4, 2));
+        pb.close();
+
+        // An append abandoned after a bad row leaves the dataset as it was
+        struct stat bed, bim, result;
+        TS_ASSERT_EQUALS(0, stat((tmpfile + ".bed").c_str(), &bed));
+        TS_ASSERT_EQUALS(0, stat((tmpfile + ".bim").c_str(), &bim));
+        string text = tmpfile + ".txt";
+        std::ofstream out(text.c_str());
+        out << "\tsample_000\tsample_001\tsample_002\tsample_003\n";
+        for (int i = 0; i < 100; i++) {
+            out << "rs3" << i << "\tAA\tAC\tCC\tNN\n";
+        }
+        out << "rs4000\tAA\tAC\n";
+        out.close();
+        int fd = ::open(text.c_str(), O_RDONLY);
+        gftools::tab_matrix_reader reader(fd, 'N', "4", 1);
+        pb.open_append(tmpfile);
+        pb.write_snp(snp, vector<uint8_t>(4, 1));
+        TS_ASSERT_THROWS(reader.write_rows(pb), gftools::malformed_data);
+        pb.abort();
+        ::close(fd);
+        remove(text.c_str());
+        TS_ASSERT_EQUALS(0, stat((tmpfile + ".bed").c_str(), &result));
+        TS_ASSERT_EQUALS(bed.st_size, result.st_size);
+        TS_ASSERT_EQUALS(0, stat((tmpfile + ".bim").c_str(), &result));
+        TS_ASSERT_EQUALS(bim.st_size, result.st_size);
+        pb.open(tmpfile);
+        TS_ASSERT_EQUALS(6, pb.snps.size());
+        pb.close();
+
+        // The BED file must hold exactly the SNPs of the BIM file
+        TS_ASSERT_EQUALS(0, truncate((tmpfile + ".bed").c_str(), 8));
+        TS_ASSERT_THROWS(pb.open_append(tmpfile), gftools::malformed_data);
+
+        const char *suffixes[] = { ".bed", ".bim", ".fam" };
+        for (int i = 0; i < 3; i++) {
+            remove((tmpfile + suffixes[i]).c_str());
+        }
+    }
+
+    void test_stream_bim() {
+        char *tmpname = tmpnam(NULL);
+        if (!tmpname) {
+            TS_FAIL("Failed to create a temporary file name");
+            return;
+        }
+        string tmpfile = string(tmpname);
+
+        plink_binary pb = plink_binary();
+        pb.stream_bim = true;
+        pb.individuals.resize(4);
+        pb.open(tmpfile, 1);
+        TS_ASSERT_THROWS(pb.presize_snps(3), gftools::malformed_data);
+
+        snp snp;
+        snp.chromosome = "1";
+        snp.allele_a = "A";
+        snp.allele_b = "C";
+        vector<uint8_t> calls(4, 2);
+        for (int i = 0; i < 3; i++) {
+            snp.name = "rs" + string(1, 'a' + i);
+            snp.physical_position = 100 * i;
+            pb.write_snp(snp, calls);
+        }
+        TS_ASSERT(pb.snps.empty());
+        TS_ASSERT_EQUALS(3, pb.snp_count());
+        TS_ASSERT_EQUALS(0, access((tmpfile + ".bim.tmp").c_str(), F_OK));
+        TS_ASSERT_EQUALS(-1, access((tmpfile + ".bim").c_str(), F_OK));
+        pb.close();
+        TS_ASSERT_EQUALS(-1, access((tmpfile + ".bim.tmp").c_str(), F_OK));
+
+        plink_binary result = plink_binary(tmpfile);
+        TS_ASSERT_EQUALS(3, result.snps.size());
+        TS_ASSERT_EQUALS("rsc", result.snps[2].name);
+        TS_ASSERT_EQUALS(200, result.snps[2].physical_position);
+        TS_ASSERT_EQUALS("C", result.snps[2].allele_b);
+        result.read_snp(1, calls);
+        TS_ASSERT(calls == vector<uint8_t>(4, 2));
+        result.close();
+
+        // A failed close removes the temporary BIM file
+        string empty = tmpfile + "_empty";
+        pb.individuals.resize(4);
+        pb.open(empty, 1);
+        TS_ASSERT_EQUALS(0, access((empty + ".bim.tmp").c_str(), F_OK));
+        TS_ASSERT_THROWS(pb.close(), gftools::malformed_data);
+        TS_ASSERT_EQUALS(-1, access((empty + ".bim.tmp").c_str(), F_OK));
+        remove((empty + ".bed").c_str());
+        remove((empty + ".fam").c_str());
+
+        const char *suffixes[] = { ".bed", ".bim", ".fam" };
+        for (int i = 0; i < 3; i++) {
+            remove((tmpfile + suffixes[i]).c_str());
+        }
+    }
+
+    void test_copy_snps() {
+        char *tmpname = tmpnam(NULL);
+        if (!tmpname) {
+            TS_FAIL("Failed to create a temporary file name");
+            return;
+        }
+        string tmpfile = string(tmpname);
+
+        plink_binary source = plink_binary("data");
+        plink_binary pb = plink_binary();
+        pb.individuals = source.individuals;
+        pb.open(tmpfile, 1);
+        pb.copy_snps(source, 1, 3);
+        pb.copy_snps(source, 0, 1);
+        TS_ASSERT_THROWS(pb.copy_snps(source, 2, 3), gftools::malformed_data);
+        pb.close();
+
+        plink_binary result = plink_binary(tmpfile);
+        result.missing_genotype = '0';
+        TS_ASSERT_EQUALS(4, result.snps.size());
+        TS_ASSERT_EQUALS("rs1001", result.snps[0].name);
+        TS_ASSERT_EQUALS("rs1000", result.snps[3].name);
+        vector<string> genotypes;
+        for (int i = 0; i < 4; i++) {
+            result.read_snp(result.snps[i].name, genotypes);
+            TS_ASSERT_EQUALS(expected_gen[result.snps[i].name], genotypes);
+        }
+        result.close();
+
+        // The individuals must match, in the same order
+        pb.individuals = source.individuals;
+        std::swap(pb.individuals[0], pb.individuals[1]);
+        pb.open(tmpfile, 1);
+        TS_ASSERT_THROWS(pb.copy_snps(source, 0, 1), gftools::malformed_data);
+        TS_ASSERT_THROWS(pb.close(), gftools::malformed_data);
+        source.close();
+
+        const char *suffixes[] = { ".bed", ".bim", ".fam" };
+        for (int i = 0; i < 3; i++) {
+            remove((tmpfile + suffixes[i]).c_str());
+        }
+    }
+
+    void test_output_stage() {
+        char *tmpname = tmpnam(NULL);
+        if (!tmpname) {
+            TS_FAIL("Failed to create a temporary file name");
+            return;
+        }
+        string tmpfile = string(tmpname);
+
+        // Small buffers, so that the producer often waits for the writer
+        int fd = ::open(tmpfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        gftools::output_stage stage(fd, 16, 2);
+        string expected;
+        for (int i = 0; i < 1000; i++) {
+            string s(i % 7, 'a' + i % 26);
+            stage.write(s.data(), s.size());
+            expected += s;
+
+            unsigned char *p = stage.claim(5);
+            TS_ASSERT(p != NULL);
+            memcpy(p, "01234", 5);
+            stage.commit(i % 6);
+            expected += string("01234", i % 6);
+        }
+        TS_ASSERT(stage.claim(17) == NULL);
+        stage.close();
+        ::close(fd);
+
+        std::ifstream in(tmpfile.c_str(), std::ios::binary);
+        std::stringstream written;
+        written << in.rdbuf();
+        TS_ASSERT(written.str() == expected);
+
+        // Write errors are reported by close
+        fd = ::open(tmpfile.c_str(), O_RDONLY);
+        gftools::output_stage failing(fd, 16, 2);
+        failing.write("0123456789", 10);
+        TS_ASSERT_THROWS(failing.close(), gftools::malformed_data);
+        ::close(fd);
+
+        // and by the next write or commit once the I/O thread has failed
+        fd = ::open(tmpfile.c_str(), O_RDONLY);
+        gftools::output_stage pending(fd, 16, 2);
+        pending.write("0123456789012345", 16);
+        pending.claim(1);
+        pending.commit(1);
+        TS_ASSERT_THROWS(pending.flush(), gftools::malformed_data);
+        TS_ASSERT_THROWS(pending.write("0", 1), gftools::malformed_data);
+        TS_ASSERT_THROWS(pending.commit(0), gftools::malformed_data);
+        ::close(fd);
+        remove(tmpfile.c_str());
+    }
+
+    void test_presize_snps() {
+        char *tmpname = tmpnam(NULL);
+        if (!tmpname) {
+            TS_FAIL("Failed to create a temporary file name");
+            return;
+        }
+        string tmpfile = string(tmpname);
+
+        // Two threads write six SNPs backwards, past the estimate of two
+        plink_binary pb = plink_binary();
+        pb.individuals.resize(4);
+        pb.open(tmpfile, 1);
+        pb.presize_snps(2);
+        pthread_t threads[2];
+        write_job jobs[2];
+        for (int i = 0; i < 2; i++) {
+            jobs[i].pb = &pb;
+            jobs[i].remainder = i;
+            jobs[i].errors = 0;
+            TS_ASSERT_EQUALS(0, pthread_create(&threads[i], NULL, write_slots,
+                                               &jobs[i]));
+        }
+        for (int i = 0; i < 2; i++) {
+            pthread_join(threads[i], NULL);
+            TS_ASSERT_EQUALS(0, jobs[i].errors);
+        }
+        snp snp;
+        vector<uint8_t> calls(4, 1);
+        TS_ASSERT_THROWS(pb.write_snp_at(3, snp, calls), gftools::malformed_data);
+        TS_ASSERT_THROWS(pb.write_snp(snp, calls), gftools::malformed_data);
+        pb.close();
+
+        plink_binary result = plink_binary(tmpfile);
+        TS_ASSERT_EQUALS(6, result.snps.size());
+        for (int i = 0; i < 6; i++) {
+            TS_ASSERT_EQUALS("rs" + string(1, 'a' + i), result.snps[i].name);
+            result.read_snp(i, calls);
+            TS_ASSERT(calls == vector<uint8_t>(4, i % 4));
+        }
+        result.close();
+
+        // Every slot up to the last must be written
+        pb.individuals.resize(4);
+        pb.open(tmpfile, 1);
+        pb.presize_snps(3);
+        pb.write_snp_at(2, snp, calls);
+        TS_ASSERT_THROWS(pb.close(), gftools::malformed_data);
+
+        const char *suffixes[] = { ".bed", ".bim", ".fam" };
+        for (int i = 0; i < 3; i++) {
+            remove((tmpfile + suffixes[i]).c_str());
+        }
+    }
+
+    void test_tab_matrix() {
+        char *tmpname = tmpnam(NULL);
+        if (!tmpname) {
+            TS_FAIL("Failed to create a temporary file name");
+            return;
+        }
+        string tmpfile = string(tmpname);
+        string text = tmpfile + ".txt";
+
+        // CRLF line ends, runs of tabs and no newline at the end
+        std::ofstream out(text.c_str());
+        out << "\tind1\tind2\tind3\r\n";
+        out << "rs1\tAG\tGG\t\tNN\r\n";
+        out << "\n";
+        out << "rs2\tTT\tTT\tNN";
+        out.close();
+
+        int fd = ::open(text.c_str(), O_RDONLY);
+        gftools::tab_matrix_reader reader(fd, 'N', "X", 2);
+        TS_ASSERT_EQUALS(3, reader.sample_names().size());
+        TS_ASSERT_EQUALS("ind3", reader.sample_names()[2]);
+
+        plink_binary pb = plink_binary();
+        for (int i = 0; i < 3; i++) {
+            pb.individuals.push_back(individual());
+            pb.individuals.back().name = reader.sample_names()[i];
+        }
+        pb.open(tmpfile, 1);
+        pb.missing_genotype = 'N';
+        reader.write_rows(pb);
+        pb.close();
+        ::close(fd);
+
+        plink_binary result = plink_binary(tmpfile);
+        TS_ASSERT_EQUALS(2, result.snps.size());
+        TS_ASSERT_EQUALS("X", result.snps[1].chromosome);
+        TS_ASSERT_EQUALS("A", result.snps[0].allele_a);
+        TS_ASSERT_EQUALS("G", result.snps[0].allele_b);
+        TS_ASSERT_EQUALS("T", result.snps[1].allele_a);
+        vector<uint8_t> calls;
+        result.read_snp(0, calls);
+        uint8_t expected[] = {2, 3, 0};
+        TS_ASSERT(calls == vector<uint8_t>(expected, expected + 3));
+        result.close();
+
+        // A short row is rejected
+        out.open(text.c_str());
+        out << "\tind1\tind2\nrs1\tAA\n";
+        out.close();
+        fd = ::open(text.c_str(), O_RDONLY);
+        gftools::tab_matrix_reader short_reader(fd, 'N', "0", 1);
+        pb.open(tmpfile, 1);
+        TS_ASSERT_THROWS(short_reader.write_rows(pb), gftools::malformed_data);
+        ::close(fd);
+
+        const char *suffixes[] = { ".bed", ".bim", ".fam", ".txt" };
+        for (int i = 0; i < 4; i++) {
+            remove((tmpfile + suffixes[i]).c_str());
+        }
+    }
+
+    void test_sidecar() {
+        char *tmpname = NULL;
+        tmpname = tmpnam(NULL);
+        if (!tmpname) {
+            TS_FAIL("Failed to create a temporary file name");
+            return;
+        }
+        string tmpfile = string(tmpname);
+        copy_dataset("data", tmpfile);
+
+        gftools::snp_table table;
+        vector<individual> individuals;
+        gftools::region_index regions;
+        gftools::source_stamps stamps;
+        TS_ASSERT(stamps.take(tmpfile));
+        TS_ASSERT(!gftools::read_sidecar(tmpfile, stamps, table, individuals,
+                                         regions));
+
+        // Opening writes the sidecar, then reopening loads it, with the
+        // SNPs in either layout
+        for (int i = 0; i < 3; i++) {
+            plink_binary pb = plink_binary();
+            pb.use_sidecar = true;
+            pb.compact_snps = i == 2;
+            pb.open(tmpfile);
+            pb.missing_genotype = '0';
+            TS_ASSERT_EQUALS(4, pb.snp_count());
+            TS_ASSERT_EQUALS(i == 2 ? 0 : 4, pb.snps.size());
+            TS_ASSERT_EQUALS(4, pb.individuals.size());
+            snp snp;
+            pb.snp_at(2, snp);
+            TS_ASSERT_EQUALS("C", snp.allele_b);
+            TS_ASSERT_EQUALS(3, snp.physical_position);
+            TS_ASSERT_EQUALS(expected_ind[3], pb.individuals[3].name);
+
+            vector<string> genotypes;
+            pb.read_snp("rs1003", genotypes);
+            TS_ASSERT_EQUALS(expected_gen["rs1003"], genotypes);
+            vector<gftools::snp_range> ranges;
+            pb.find_region("2", 2, 4, ranges);
+            TS_ASSERT_EQUALS(1, ranges.size());
+            TS_ASSERT_EQUALS(1, ranges[0].first);
+            TS_ASSERT_EQUALS(3, ranges[0].count);
+            pb.close();
+            TS_ASSERT(gftools::read_sidecar(tmpfile, stamps, table,
+                                            individuals, regions));
+        }
+        TS_ASSERT_EQUALS(2, table.find("rs1002"));
+        TS_ASSERT_EQUALS("rs1002", table.name(2));
+        vector<gftools::snp_range> ranges;
+        regions.find("2", ranges);
+        TS_ASSERT_EQUALS(1, ranges.size());
+
+        // A changed BIM file makes the sidecar stale
+        std::ofstream bim((tmpfile + ".bim").c_str(), std::ios::app);
+        bim << "2\trs1004\t0\t5\tA\tG" << std::endl;
+        bim.close();
+        gftools::source_stamps before = stamps;
+        TS_ASSERT(stamps.take(tmpfile));
+        TS_ASSERT(!gftools::read_sidecar(tmpfile, stamps, table, individuals,
+                                         regions));
+
+        // A sidecar is not written for sources changed since their stamps
+        plink_binary pb = plink_binary(tmpfile);
+        gftools::snp_table snps(pb.snps);
+        TS_ASSERT(!gftools::write_sidecar(tmpfile, before, snps,
+                                          pb.individuals,
+                                          gftools::region_index(snps)));
+        TS_ASSERT(!gftools::read_sidecar(tmpfile, stamps, table, individuals,
+                                         regions));
+        TS_ASSERT(gftools::write_sidecar(tmpfile, stamps, snps, pb.individuals,
+                                         gftools::region_index(snps)));
+        pb.close();
+        TS_ASSERT(gftools::read_sidecar(tmpfile, stamps, table, individuals,
+                                        regions));
+        TS_ASSERT_EQUALS(5, table.size());
+
+        // A damaged sidecar is ignored
+        TS_ASSERT_EQUALS(0, truncate((tmpfile + ".gfidx").c_str(), 100));
+        TS_ASSERT(!gftools::read_sidecar(tmpfile, stamps, table, individuals,
+                                         regions));
+
+        const char *suffixes[] = { ".bed", ".bim", ".fam", ".gfidx" };
+        for (int i = 0; i < 4; i++) {
+            remove((tmpfile + suffixes[i]).c_str());
+        }
+    }
+
     void test_write_snp() {
         snp snp;
         snp.name = "test_snp";
@@ -275,6 +1443,71 @@ public:
         }
     }
 
+    void test_genotypes_atoi() {
+        plink_binary pb = plink_binary();
+        pb.missing_genotype = 'N';
+
+        // Alleles are collated from the calls when the SNP has none
+        snp snp;
+        const char *tokens[] = {"NN", "CA", "AA", "CC", "AC"};
+        vector<string> calls(tokens, tokens + 5);
+        vector<uint8_t> codes;
+        pb.genotypes_atoi(snp, calls, codes);
+        uint8_t expected[] = {0, 2, 3, 1, 2};
+        TS_ASSERT(codes == vector<uint8_t>(expected, expected + 5));
+        TS_ASSERT_EQUALS("C", snp.allele_a);
+        TS_ASSERT_EQUALS("A", snp.allele_b);
+
+        // Otherwise the alleles of the SNP are used
+        snp.allele_a = "A";
+        snp.allele_b = "C";
+        codes.clear();
+        pb.genotypes_atoi(snp, calls, codes);
+        uint8_t known[] = {0, 2, 1, 3, 2};
+        TS_ASSERT(codes == vector<uint8_t>(known, known + 5));
+
+        calls.push_back("AG");
+        TS_ASSERT_THROWS(pb.genotypes_atoi(snp, calls, codes),
+                         gftools::malformed_data);
+        gftools::snp unknown;
+        TS_ASSERT_THROWS(pb.genotypes_atoi(unknown, calls, codes),
+                         gftools::malformed_data);
+        calls.back() = "AN";
+        TS_ASSERT_THROWS(pb.genotypes_atoi(snp, calls, codes),
+                         gftools::malformed_data);
+        calls.back() = "A";
+        TS_ASSERT_THROWS(pb.genotypes_atoi(snp, calls, codes),
+                         gftools::malformed_data);
+
+        // A SNP written without alleles keeps its calls, rather than
+        // becoming all no-calls, and is given the collated alleles
+        char *tmpname = tmpnam(NULL);
+        if (!tmpname) {
+            TS_FAIL("Failed to create a temporary file name");
+            return;
+        }
+        string tmpfile = string(tmpname);
+        pb.individuals.resize(5);
+        pb.open(tmpfile, 1);
+        gftools::snp bare;
+        bare.name = "rs1";
+        calls.pop_back();
+        pb.write_snp(bare, calls);
+        pb.close();
+
+        plink_binary result = plink_binary(tmpfile);
+        TS_ASSERT_EQUALS("C", result.snps[0].allele_a);
+        TS_ASSERT_EQUALS("A", result.snps[0].allele_b);
+        result.read_snp(0, codes);
+        TS_ASSERT(codes == vector<uint8_t>(expected, expected + 5));
+        result.close();
+
+        const char *suffixes[] = { ".bed", ".bim", ".fam" };
+        for (int i = 0; i < 3; i++) {
+            remove((tmpfile + suffixes[i]).c_str());
+        }
+    }
+
     void test_collate_alleles() {
       plink_binary pb = plink_binary("data");
       vector<string> genotype_calls;
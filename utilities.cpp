@@ -21,6 +21,7 @@
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <unistd.h>
 
 #include "utilities.h"
 
@@ -30,11 +31,20 @@ using std::string;
 namespace gftools {
 
     const string error_message() {
-        char *msg = strerror(errno);
+        return error_message(errno);
+    }
+
+    const string error_message(int error) {
+        char *msg = strerror(error);
         return msg ? string(msg) : "unknown error";
     }
 
     bool at_eof(ifstream &ifstream) {
         return ifstream.peek() == ifstream::traits_type::eof();
     }
+
+    int cpu_count() {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? (int) n : 1;
+    }
 }
@@ -20,7 +20,10 @@
 #ifndef GFTOOLS_UTILITIES_H
 #define GFTOOLS_UTILITIES_H
 
+#include <cstring>
 #include <fstream>
+#include <string>
+#include <vector>
 
 namespace gftools {
 
@@ -30,9 +33,64 @@ namespace gftools {
      */
     const std::string error_message();
 
+    /** Returns the C error message of an error number, such as those
+     * returned by the pthread functions, which do not set errno.
+     *
+     * @param error An error number.
+     * @returns The error message or 'unknown error',
+     */
+    const std::string error_message(int error);
+
     /** Returns true if the next element in the stream is eof.
      */
     bool at_eof(std::ifstream &ifstream);
+
+    /** Returns the number of online CPUs, at least 1.
+     */
+    int cpu_count();
+
+    /** Appends the elements of a vector to a block of bytes, in native
+     * layout, padded with zeros to a multiple of 8 bytes.
+     *
+     * @param out The block of bytes.
+     * @param v A vector of plain values.
+     */
+    template <typename T>
+    void append_array(std::string &out, const std::vector<T> &v) {
+        size_t len = v.size() * sizeof(T);
+        if (len) {
+            out.append((const char *) &v[0], len);
+        }
+        out.append((8 - len % 8) % 8, '\0');
+    }
+
+    /** Reads elements appended by append_array.
+     *
+     * @param p The start of the elements, advanced past them and their
+     * padding.
+     * @param end The end of the block of bytes.
+     * @param n The number of elements.
+     * @param v A vector, overwritten with the elements.
+     * @return false if the elements overrun the block.
+     */
+    template <typename T>
+    bool read_array(const char *&p, const char *end, size_t n,
+                    std::vector<T> &v) {
+        if (n > (size_t) (end - p) / sizeof(T)) {
+            return false;
+        }
+        size_t len = n * sizeof(T);
+        size_t padded = len + (8 - len % 8) % 8;
+        if (padded > (size_t) (end - p)) {
+            return false;
+        }
+        v.resize(n);
+        if (len) {
+            memcpy(&v[0], p, len);
+        }
+        p += padded;
+        return true;
+    }
 }
 
 #endif // GFTOOLS_UTILITIES_H